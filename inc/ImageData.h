@@ -4,6 +4,10 @@
 
 #include "stb_image.h"
 #include "stb_image_write.h"
+#include "Parallel.h"
+#include "PngEncoder.h"
+#include "MappedFile.h"
+#include "TiledImage.h"
 
 #include <vector>
 #include <array>
@@ -11,9 +15,35 @@
 #include <stdexcept>
 #include <algorithm>
 #include <iostream>
-
-enum class ImageFormat { PNG, JPG, BMP };
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <type_traits>
+#include <span>
+#include <functional>
+#include <limits>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <filesystem>
+#include <cstdio>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGEDATA_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// IndexedPNG needs at most 256 distinct RGBA colours (see ImageData::quantize)
+// PPM, PAM and Raw are uncompressed interchange formats: PPM is RGB, PAM and Raw keep alpha.
+// Tiled is the native LZ4-compressed tile container (TiledImage.h), readable a region at a time.
+enum class ImageFormat { PNG, JPG, BMP, IndexedPNG, PPM, PAM, Raw, Tiled };
 enum class ColorChannel { Invalid = 0, G = 1, GA = 2, RGB = 3, RGBA = 4 };
+enum class HistogramChannel { R, G, B, A, Luma };
+enum class IntegralSource { RGBA, Luma };
+enum class QuantizeMethod { MedianCut, KMeans };
 
 // Pixel structs will always have RGBA (4) channels, regardless of image input/output formats
 constexpr int pixelChannels = static_cast<int>(ColorChannel::RGBA);
@@ -28,6 +58,166 @@ struct Pixel
 template <typename T>
 using Vector2D = std::vector<std::vector<T>>;
 
+// Rec. 601 luma in 16-bit fixed point; the weights sum to 65536 so white maps to 255
+constexpr unsigned char luma(const Pixel& pixel)
+{
+	return static_cast<unsigned char>((19595 * pixel.r + 38470 * pixel.g + 7471 * pixel.b) >> 16);
+}
+
+using Histogram = std::array<std::uint32_t, 256>;
+
+struct ImageHistogram
+{
+	std::array<Histogram, 5> channels{};
+
+	const Histogram& operator[](HistogramChannel channel) const { return channels[static_cast<int>(channel)]; }
+};
+
+class ImageData;
+
+// Container format detected from a file's signature; TGA has none and is whatever stb_image accepts otherwise
+enum class FileFormat { Unknown, PNG, JPEG, BMP, GIF, PSD, HDR, PNM, PIC, TGA, PAM, Raw, Tiled };
+
+// Where the pixels of an uncompressed 8-bit PNM, PAM or raw file start; rows are tightly packed
+struct InterchangeHeader
+{
+	FileFormat format{ FileFormat::Unknown };
+	int width{};
+	int height{};
+	int channels{};
+	// Samples run 0..maxValue (1-255) and are rescaled to 0..255 on load
+	int maxValue{ 255 };
+	size_t dataOffset{};
+};
+
+// Everything the header says: channels is the file's own count (1-4), bitDepth 8, 16 or 32 (float HDR)
+struct ImageInfo
+{
+	int width{};
+	int height{};
+	int channels{};
+	int bitDepth{};
+	FileFormat format{ FileFormat::Unknown };
+};
+
+struct Rect
+{
+	int x{};
+	int y{};
+	int width{};
+	int height{};
+
+	bool empty() const { return width <= 0 || height <= 0; }
+};
+
+Rect intersect(const Rect& a, const Rect& b)
+{
+	int x0 = std::max(a.x, b.x);
+	int y0 = std::max(a.y, b.y);
+	int x1 = std::min(a.x + a.width, b.x + b.width);
+	int y1 = std::min(a.y + a.height, b.y + b.height);
+	return { x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0) };
+}
+
+enum class PyramidFilter { Box, Gaussian };
+enum class Interpolation { Nearest, Bilinear, Bicubic };
+
+// Row-major 2x3 affine and 3x3 projective transforms mapping source coordinates to destination coordinates
+using AffineMatrix = std::array<float, 6>;
+using Homography = std::array<float, 9>;
+
+// Every level of a pyramid lives in one contiguous pixel buffer; level 0 is the source image
+struct ImagePyramid
+{
+	struct Level
+	{
+		int width{};
+		int height{};
+		size_t offset{};
+	};
+
+	std::vector<Pixel> pixels{};
+	std::vector<Level> levels{};
+
+	int levelCount() const { return static_cast<int>(levels.size()); }
+
+	const Pixel* levelData(int level) const { return pixels.data() + levels[level].offset; }
+
+	ImageData level(int level) const;
+};
+
+// Float channel ranges per space: RGB, S, V, L (HSL), Y in [0, 1]; hue in degrees [0, 360);
+// Cb, Cr in [-0.5, 0.5] (BT.601 full range); Lab L* in [0, 100] with a*, b* roughly [-128, 127] (D65)
+enum class ColorSpace { RGB, HSV, HSL, YCbCr, Lab };
+
+// Full-scale sample value per plane type: 8- and 16-bit planes are unsigned integers,
+// float planes are normalised so that 1.0 is full scale (and may exceed it)
+template <typename T>
+struct PlaneTraits;
+
+template <>
+struct PlaneTraits<unsigned char> { static constexpr float maxValue{ 255.0f }; };
+
+template <>
+struct PlaneTraits<std::uint16_t> { static constexpr float maxValue{ 65535.0f }; };
+
+template <>
+struct PlaneTraits<float> { static constexpr float maxValue{ 1.0f }; };
+
+// Float result to sample: integer types clamp and truncate like ImageData's kernels, float is left unclamped
+template <typename T>
+constexpr T toSample(float value)
+{
+	if constexpr (std::is_floating_point_v<T>) {
+		return value;
+	}
+	else {
+		return static_cast<T>(std::clamp(value, 0.0f, PlaneTraits<T>::maxValue));
+	}
+}
+
+// Channel-planar image: plane c holds channel c of every pixel, row-major with no padding.
+// Planes 0-2 are the colour channels in `space`, plane 3 is alpha ([0, 1] for float planes).
+// T is unsigned char, std::uint16_t or float (see PlaneTraits).
+template <typename T>
+struct PlanarImage
+{
+	int width{};
+	int height{};
+	ColorSpace space{ ColorSpace::RGB };
+	std::array<std::vector<T>, 4> planes{};
+
+	PlanarImage() = default;
+
+	PlanarImage(int w, int h, ColorSpace colorSpace = ColorSpace::RGB)
+		: width{ w }, height{ h }, space{ colorSpace }
+	{
+		if (w <= 0 || h <= 0) {
+			throw std::invalid_argument("Invalid input");
+		}
+		for (auto& plane : planes) {
+			plane.resize(static_cast<size_t>(w) * h);
+		}
+	}
+
+	T* row(int plane, int y) { return planes[plane].data() + static_cast<size_t>(y) * width; }
+
+	const T* row(int plane, int y) const { return planes[plane].data() + static_cast<size_t>(y) * width; }
+};
+
+// Converts the colour planes of image to the given space in place (alpha is unchanged)
+void convertColorSpace(PlanarImage<float>& image, ColorSpace to);
+
+enum class ToneMapOperator { Reinhard, ACES, Filmic };
+
+// Geometric mean of the Rec. 709 luminance of linear RGB planes, as a parallel reduction over row bands
+float logAverageLuminance(const PlanarImage<float>& image);
+
+// Maps linear HDR RGB planes (e.g. from loadPlanarImage<float> on a .hdr file) to an 8-bit sRGB image
+// in one pass. Exposure scales the scene so that its log-average luminance lands on key; pass a
+// non-positive key to skip that and use the radiance values as they are.
+ImageData toneMap(const PlanarImage<float>& hdr, ToneMapOperator op = ToneMapOperator::Reinhard, float key = 0.18f);
+
 class ImageData
 {
 
@@ -39,14 +229,62 @@ private:
 
 public:
 	ImageData() = default;
+	ImageData(int w, int h, const Pixel& fill = {});
 	~ImageData() = default;
 
 	// Image IO functions
 	// --------------------------------------------------------------------------------
 
+	// Decodes from a read-only memory mapping of the file, released as soon as decoding ends
 	void loadImage(const char* inputFile);
 
-	void saveImage(const char* outputFile, ImageFormat format, int quality = 90);
+	// Decodes an encoded image (any format loadImage accepts) held in memory
+	void loadFromMemory(std::span<const std::byte> buffer);
+
+	// Loads only the part of a tiled image inside region (clipped to the image), decompressing just the
+	// tiles it overlaps; the result is region-sized
+	void loadRegion(const char* inputFile, const Rect& region);
+
+	void loadRegion(std::span<const std::byte> buffer, const Rect& region);
+
+	// Reads only the header: size, channels, depth and format without decoding any pixels. A prefix
+	// holding the header is enough for every format, including PPM, PAM, raw and tiled.
+	static ImageInfo probe(const char* inputFile);
+
+	static ImageInfo probe(std::span<const std::byte> buffer);
+
+	// quality applies to JPG; png sets the compression level, filter heuristic and stripe size for PNG output.
+	// The file is written to a uniquely named temporary next to outputFile and renamed over it
+	// only once encoding succeeds.
+	void saveImage(const char* outputFile, ImageFormat format, int quality = 90, const PngOptions& png = {});
+
+	// Receives the encoded bytes in one or more consecutive chunks
+	using EncodeSink = std::function<void(const std::byte* data, size_t size)>;
+
+	// Encodes to memory instead of a file; saveImage is encodeTo with a file sink. PNG is streamed:
+	// rows are compressed a band at a time and handed over as they finish, without a packed copy.
+	void encodeTo(ImageFormat format, const EncodeSink& sink, int quality = 90, const PngOptions& png = {}) const;
+
+	std::vector<std::byte> encodeTo(ImageFormat format, int quality = 90, const PngOptions& png = {}) const;
+
+private:
+	// Replaces the pixels with a copy of tightly packed rows of dataChannels samples (grey, grey + alpha, RGB or RGBA).
+	// A lut, if given, maps every file sample on the way in; alpha that the file lacks stays 255.
+	void assignPixelData(const unsigned char* data, int w, int h, int fileChannels, int dataChannels = pixelChannels,
+		const std::array<unsigned char, 256>* lut = nullptr);
+
+	// Copies the pixels straight out of an uncompressed PNM, PAM or raw buffer; false for any other format
+	bool assignInterchange(std::span<const std::byte> buffer);
+
+	// Replaces the pixels with region (clipped to the image) of a tiled container
+	void assignTiled(const TiledImageReader& reader, const Rect& region);
+
+	void streamPng(const EncodeSink& sink, const PngOptions& options) const;
+
+	// Header, then the pixel rows themselves (PAM, Raw) or one repacked row at a time (PPM)
+	void writeInterchange(ImageFormat format, const EncodeSink& sink) const;
+
+public:
 
 
 	// Getters/Setters
@@ -63,6 +301,15 @@ public:
 	void setPixel(int y, int x, const Pixel& pixel) { pixels[y][x] = pixel; }
 
 
+	// Planar Layout
+	// --------------------------------------------------------------------------------
+
+	// Splits the pixels into separate R, G, B, A planes and merges them back (SSE2, 16 pixels at a time)
+	PlanarImage<unsigned char> unpackPlanes() const;
+
+	void packPlanes(const PlanarImage<unsigned char>& planar);
+
+
 	// Monochrome and Tone
 	// --------------------------------------------------------------------------------
 
@@ -70,6 +317,29 @@ public:
 
 	void threshold(unsigned char thresholdValue = 128);
 
+	// Picks the threshold that maximises Otsu's between-class variance of the luma histogram,
+	// applies it and returns it
+	unsigned char thresholdOtsu();
+
+	// Local-mean binarisation: a pixel turns white when its luma exceeds the mean of the
+	// blockSize x blockSize window around it minus offset. Cost is independent of blockSize.
+	void adaptiveThreshold(int blockSize, int offset = 0);
+
+	// Binarises luma against a bayerN x bayerN Bayer matrix (bayerN a power of two up to 16)
+	void ditherOrdered(int bayerN = 4);
+
+	// Error-diffusion binarisation of luma. Rows run in parallel as a wavefront, each row
+	// trailing the one above by a few pixels so every pixel sees its full diffused error.
+	void ditherFloydSteinberg();
+
+	void ditherAtkinson();
+
+private:
+	template <typename Diffuse>
+	void diffuseError(Diffuse diffuse);
+
+public:
+
 	void invert();
 
 
@@ -82,7 +352,63 @@ public:
 
 	void tint(const Pixel& color, float strength);
 
-	void noise(float intensity);
+	// Float planes in the given colour space; the inverse replaces this image, rounding back to 8 bits
+	PlanarImage<float> toPlanar(ColorSpace space = ColorSpace::RGB) const;
+
+	void fromPlanar(const PlanarImage<float>& planar);
+
+	// Re-encodes R, G, B in place between 8-bit colour spaces (alpha untouched). Non-RGB channels are
+	// stored as: hue * 256 / 360 (wrapping), S/V/L/Y * 255, Cb/Cr * 255 + 128, L* * 255 / 100, a*/b* + 128
+	void convertColorSpace(ColorSpace from, ColorSpace to);
+
+	// Scales HSV saturation by factor
+	void saturation(float factor);
+
+	void hueShift(float degrees);
+
+private:
+	// Runs fn(c0, c1, c2, count) over each row's colour channels converted to space, then converts back
+	template <typename Fn>
+	void transformInColorSpace(ColorSpace space, Fn fn);
+
+public:
+
+	// Reduces the image to at most maxColors RGBA colours (2-256) and returns the palette, so the
+	// result can always be saved as IndexedPNG. The palette is built from a subsampled 5:5:5:3
+	// RGBA histogram and pixels are mapped through the matching nearest-colour grid.
+	std::vector<Pixel> quantize(int maxColors, QuantizeMethod method = QuantizeMethod::MedianCut);
+
+	// Uniform noise in [-128, 127] * intensity per channel. Noise is a pure function of
+	// (seed, pixel index), so the same seed always produces the same image
+	void noise(float intensity, std::uint64_t seed = 0);
+
+	// Zero-mean Gaussian noise with standard deviation sigma (in 0-255 units)
+	void gaussianNoise(float sigma, std::uint64_t seed = 0);
+
+	using LookupTable = std::array<unsigned char, 256>;
+
+	// Maps the R, G and B channels through lut
+	void applyLookupTable(const LookupTable& lut);
+
+
+	// Histograms
+	// --------------------------------------------------------------------------------
+
+	// R, G, B, A and luma histograms in a single pass
+	ImageHistogram histogram() const;
+
+	Histogram histogram(HistogramChannel channel) const;
+
+	// Joint 256x256 histogram, indexed [first * 256 + second]
+	std::vector<std::uint32_t> histogram2D(HistogramChannel first, HistogramChannel second) const;
+
+	// Both equalisers remap luma from its histogram and scale R, G and B by the new-to-old luma
+	// ratio, so hue and saturation are kept
+	void equalizeHistogram();
+
+	// Contrast-limited adaptive equalisation over a tilesX x tilesY grid. Histogram bins are
+	// clipped at clipLimit times the mean bin count (<= 0 disables clipping)
+	void clahe(int tilesX = 8, int tilesY = 8, float clipLimit = 2.0f);
 
 
 	// Geometry
@@ -100,37 +426,68 @@ public:
 
 	void crop(int x, int y, int w, int h);
 
+	ImagePyramid buildPyramid(int levels, PyramidFilter filter = PyramidFilter::Gaussian) const;
+
+	void warpAffine(const AffineMatrix& matrix, Interpolation interpolation = Interpolation::Bilinear, const Pixel& border = {});
+
+	void warpPerspective(const Homography& homography, Interpolation interpolation = Interpolation::Bilinear, const Pixel& border = {});
+
+private:
+	template <bool Projective>
+	void warp(const Homography& inverse, Interpolation interpolation, const Pixel& border);
+
+public:
+
 
 	// Compositing
 	// --------------------------------------------------------------------------------
+	// The other image is placed with its top-left corner at (x, y) in this image and only the
+	// overlapping rectangle is touched, so overlays need not match this image's size.
+
+	void blend(const ImageData& other, float alpha, int x = 0, int y = 0);
 
-	void blend(const ImageData& other, float alpha);
+	// Porter-Duff "over" of this image onto background, straight alpha; the result replaces this
+	// image's pixels inside the overlap. PremultipliedImage composites without the per-pixel divides.
+	void compositeOver(const ImageData& background, int x = 0, int y = 0);
 
-	void compositeOver(const ImageData& background);
+	// The reverse direction: Porter-Duff "over" of overlay onto this image, like the blend ops
+	void drawOver(const ImageData& overlay, int x = 0, int y = 0);
 
-	void applyAlphaMask(const ImageData& mask);
+	void applyAlphaMask(const ImageData& mask, int x = 0, int y = 0);
 
-	void multiply(const ImageData& other);
+	void multiply(const ImageData& other, int x = 0, int y = 0);
 
-	void screen(const ImageData& other);
+	void screen(const ImageData& other, int x = 0, int y = 0);
 
-	void overlay(const ImageData& other);
+	void overlay(const ImageData& other, int x = 0, int y = 0);
 
-	void darken(const ImageData& other);
+	void darken(const ImageData& other, int x = 0, int y = 0);
 
-	void lighten(const ImageData& other);
+	void lighten(const ImageData& other, int x = 0, int y = 0);
 
-	void add(const ImageData& other, float scale = 1.0f);
+	void add(const ImageData& other, float scale = 1.0f, int x = 0, int y = 0);
 
-	void subtract(const ImageData& other);
+	void subtract(const ImageData& other, int x = 0, int y = 0);
 
-	void difference(const ImageData& other);
+	void difference(const ImageData& other, int x = 0, int y = 0);
 
-	void average(const ImageData& other);
+	void average(const ImageData& other, int x = 0, int y = 0);
 
-	void max(const ImageData& other);
+	void max(const ImageData& other, int x = 0, int y = 0);
 
-	void min(const ImageData& other);
+	void min(const ImageData& other, int x = 0, int y = 0);
+
+	// Applies op to every colour channel pair of this image and other (alpha is preserved),
+	// row-parallel and SSE2-vectorised when op also has an __m128i overload. Custom ops only
+	// need the scalar overload, e.g. unsigned char operator()(unsigned char dst, unsigned char src) const.
+	// The optional clip rectangle (in this image's coordinates) further limits the touched area.
+	template <typename Op>
+	void compositeWith(const ImageData& other, const Op& op = {}, int x = 0, int y = 0);
+
+	template <typename Op>
+	void compositeWith(const ImageData& other, const Op& op, int x, int y, const Rect& clip);
+
+	Rect bounds() const { return { 0, 0, width, height }; }
 
 
 	// Convolution Kernels
@@ -187,606 +544,3629 @@ public:
 	DynamicKernel createCustomKernel(const std::vector<std::vector<float>>& values);
 
 	DynamicKernel convolveKernels(const DynamicKernel& k1, const DynamicKernel& k2);
+
+	// Mean over a (2 * radius + 1)^2 window in constant time per pixel, via an integral image
+	void boxBlur(int radius);
+};
+
+// RGBA with the colour channels already scaled by alpha, the representation in which "over"
+// needs no divides. It is kept apart from ImageData, whose operations all assume straight
+// alpha: convert in, composite, and convert back with toStraight().
+class PremultipliedImage
+{
+
+private:
+	int width{};
+	int height{};
+	Vector2D<Pixel> pixels{};
+
+public:
+	PremultipliedImage() = default;
+	explicit PremultipliedImage(const ImageData& straight);
+
+	int getWidth() const { return width; }
+
+	int getHeight() const { return height; }
+
+	Rect bounds() const { return { 0, 0, width, height }; }
+
+	// Same placement and direction as ImageData::compositeOver and ImageData::drawOver
+	void compositeOver(const PremultipliedImage& background, int x = 0, int y = 0);
+
+	void drawOver(const PremultipliedImage& overlay, int x = 0, int y = 0);
+
+	ImageData toStraight() const;
+};
+
+// Per-plane kernels run over the first planeCount planes only, so with the default of 3 alpha is
+// never read or written and every SIMD lane carries a colour value.
+// compositePlanes applies a BlendOps-style op to two equally sized planar images.
+template <typename Op>
+void compositePlanes(PlanarImage<unsigned char>& image, const PlanarImage<unsigned char>& other, const Op& op = {}, int planeCount = 3);
+
+// Same zero padding and truncation as ImageData::applyKernel, accumulated a whole row at a time.
+// Float planes are not clamped, so chained kernels keep their full range between stages.
+template <typename T>
+void convolvePlanes(PlanarImage<T>& image, const ImageData::DynamicKernel& kernel, int planeCount = 3);
+
+// Multiplies samples by factor, like ImageData::contrast
+template <typename T>
+void contrastPlanes(PlanarImage<T>& image, float factor, int planeCount = 3);
+
+// Loads RGBA planes at the requested depth from a memory-mapped file: 16-bit planes widen 8-bit
+// files by 257. Float planes hold the file's values scaled to [0, 1]; only Radiance .hdr
+// files go through stbi_loadf and hold linear radiance, unclamped.
+template <typename T>
+PlanarImage<T> loadPlanarImage(const char* inputFile);
+
+// Writes 16-bit RGBA planes as a 16-bit-per-channel PNG
+void savePlanarImage(const PlanarImage<std::uint16_t>& image, const char* outputFile, const PngOptions& options = {});
+
+// Rescales all four planes (RGB and alpha) between sample types; the planes must hold RGB data.
+// Full scale maps to full scale, and integer targets round and clamp.
+template <typename To, typename From>
+PlanarImage<To> convertPlanes(const PlanarImage<From>& image);
+
+// Summed-area table of an image's RGBA channels (interleaved) or of its luma, with optional
+// squared sums for variance queries. Box queries are O(1) and clipped to the image.
+// With 32-bit sums the running totals wrap, but any box whose true sum fits in 32 bits is
+// still exact; use 64-bit sums for larger boxes or squared sums over big windows.
+template <typename Sum = std::uint64_t>
+class IntegralImage
+{
+
+private:
+	int width{};
+	int height{};
+	int channels{};
+	std::vector<Sum> sums{};
+	std::vector<Sum> squaredSums{};
+
+	Sum query(const std::vector<Sum>& table, const Rect& box, int channel) const;
+
+public:
+	IntegralImage() = default;
+	IntegralImage(const ImageData& image, IntegralSource source = IntegralSource::RGBA, bool withSquares = false);
+
+	int getWidth() const { return width; }
+
+	int getHeight() const { return height; }
+
+	int getChannels() const { return channels; }
+
+	bool hasSquaredSums() const { return !squaredSums.empty(); }
+
+	Sum boxSum(const Rect& box, int channel = 0) const { return query(sums, box, channel); }
+
+	Sum boxSquaredSum(const Rect& box, int channel = 0) const;
+
+	double boxMean(const Rect& box, int channel = 0) const;
+
+	double boxVariance(const Rect& box, int channel = 0) const;
 };
 
+ImageData::ImageData(int w, int h, const Pixel& fill)
+	: width{ w }, height{ h }, channels{ pixelChannels }, pixels(h, std::vector<Pixel>(w, fill))
+{
+	if (w <= 0 || h <= 0) {
+		throw std::invalid_argument("Invalid input");
+	}
+}
+
 // Image IO Functions
 // ------------------------------------------------------------------------------------
 
-void ImageData::loadImage(const char* inputFile)
+// stb_image takes an int length; anything larger cannot be a valid input for it anyway
+bool decodableSize(std::span<const std::byte> buffer)
 {
-	unsigned char* data = stbi_load(inputFile, &width, &height, &channels, pixelChannels);
-	if (!data)
+	return !buffer.empty() && buffer.size() <= static_cast<size_t>(std::numeric_limits<int>::max());
+}
+
+FileFormat detectFileFormat(std::span<const std::byte> buffer)
+{
+	auto startsWith = [&](std::initializer_list<unsigned char> signature, size_t offset = 0)
 	{
-		throw std::runtime_error("Failed to load image");
-	}
-	pixels.resize(height, std::vector<Pixel>(width));
-	for (int y = 0; y < height; ++y)
+		if (buffer.size() < offset + signature.size()) {
+			return false;
+		}
+		size_t i = offset;
+		for (unsigned char expected : signature)
+		{
+			if (std::to_integer<unsigned char>(buffer[i++]) != expected) {
+				return false;
+			}
+		}
+		return true;
+	};
+	if (startsWith({ 0x89, 'P', 'N', 'G' })) return FileFormat::PNG;
+	if (startsWith({ 0xFF, 0xD8 })) return FileFormat::JPEG;
+	if (startsWith({ 'B', 'M' })) return FileFormat::BMP;
+	if (startsWith({ 'G', 'I', 'F', '8' })) return FileFormat::GIF;
+	if (startsWith({ '8', 'B', 'P', 'S' })) return FileFormat::PSD;
+	if (startsWith({ '#', '?', 'R' })) return FileFormat::HDR;
+	if (startsWith({ 'P', '5' }) || startsWith({ 'P', '6' })) return FileFormat::PNM;
+	if (startsWith({ 0x53, 0x80, 0xF6, 0x34 })) return FileFormat::PIC;
+	if (startsWith({ 'P', '7' })) return FileFormat::PAM;
+	if (startsWith({ 'I', 'R', 'A', 'W' })) return FileFormat::Raw;
+	if (startsWith({ 'I', 'T', 'I', 'L' })) return FileFormat::Tiled;
+	return FileFormat::TGA;
+}
+
+void ImageData::loadImage(const char* inputFile)
+{
+	int w = 0;
+	int h = 0;
+	int fileChannels = 0;
+	unsigned char* data = nullptr;
 	{
-		for (int x = 0; x < width; ++x)
+		// Decode straight from the mapping, then unmap before the pixel copy so the
+		// compressed file and the decoded image are never both resident for long
+		MappedFile file(inputFile);
+		std::span<const std::byte> bytes = file.bytes();
+		if (detectFileFormat(bytes) == FileFormat::Tiled)
 		{
-			int index = (y * width + x) * pixelChannels;
-			pixels[y][x] = { data[index], data[index + 1], data[index + 2], data[index + 3] };
+			TiledImageReader reader(bytes);
+			assignTiled(reader, { 0, 0, reader.getWidth(), reader.getHeight() });
+			return;
 		}
+		// Uncompressed files need no decoding: their rows are copied from the mapping as they are
+		if (assignInterchange(bytes)) {
+			return;
+		}
+		if (decodableSize(bytes)) {
+			data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(bytes.data()), static_cast<int>(bytes.size()), &w, &h, &fileChannels, pixelChannels);
+		}
+	}
+	if (!data)
+	{
+		throw std::runtime_error("Failed to load image");
 	}
+	assignPixelData(data, w, h, fileChannels);
 	stbi_image_free(data);
 }
 
-constexpr ColorChannel channelCount(ImageFormat format)
+void ImageData::loadFromMemory(std::span<const std::byte> buffer)
 {
-	switch (format)
+	if (detectFileFormat(buffer) == FileFormat::Tiled)
 	{
-	case ImageFormat::PNG:
-		return ColorChannel::RGBA;
-	case ImageFormat::JPG:
-		return ColorChannel::RGB;
-	case ImageFormat::BMP:
-		return ColorChannel::RGB;
-	default:
-		return ColorChannel::Invalid;
+		TiledImageReader reader(buffer);
+		assignTiled(reader, { 0, 0, reader.getWidth(), reader.getHeight() });
+		return;
+	}
+	if (assignInterchange(buffer)) {
+		return;
+	}
+	if (!decodableSize(buffer)) {
+		throw std::invalid_argument("Invalid input");
+	}
+	int w = 0;
+	int h = 0;
+	int fileChannels = 0;
+	unsigned char* data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(buffer.data()), static_cast<int>(buffer.size()), &w, &h, &fileChannels, pixelChannels);
+	if (!data)
+	{
+		throw std::runtime_error("Failed to decode image");
 	}
+	assignPixelData(data, w, h, fileChannels);
+	stbi_image_free(data);
 }
 
-std::vector<unsigned char> packPixelData(const Vector2D<Pixel>& pixels, int width, int height, ImageFormat format)
+ImageInfo ImageData::probe(const char* inputFile)
 {
-	ColorChannel colorChannel = channelCount(format);
-	std::vector<unsigned char> rawData;
-	rawData.reserve(width * height * static_cast<int>(colorChannel));
+	// Random access turns off readahead, so the probe faults in little more than the header pages
+	MappedFile file(inputFile, FileAccess::Random);
+	return probe(file.bytes());
+}
 
-	for (int y = 0; y < height; ++y)
+// Raw files: "IRAW", then width, height and channels as little-endian 32-bit integers; pixels follow at offset 16
+constexpr size_t rawHeaderBytes{ 16 };
+
+// checkPayload also requires every pixel to be present; probing passes false so a prefix will do
+InterchangeHeader readInterchangeHeader(std::span<const std::byte> buffer, bool checkPayload = true)
+{
+	InterchangeHeader header;
+	FileFormat format = detectFileFormat(buffer);
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(buffer.data());
+	size_t position = 2;
+
+	auto skipSpace = [&]()
 	{
-		for (int x = 0; x < width; ++x)
+		while (position < buffer.size())
 		{
-			const Pixel& pixel = pixels[y][x];
-			if (colorChannel == ColorChannel::RGB) {
-				rawData.push_back(pixel.r);
-				rawData.push_back(pixel.g);
-				rawData.push_back(pixel.b);
+			if (bytes[position] == '#')
+			{
+				while (position < buffer.size() && bytes[position] != '\n') {
+					++position;
+				}
 			}
-			if (colorChannel == ColorChannel::RGBA) {
-				rawData.push_back(pixel.r);
-				rawData.push_back(pixel.g);
-				rawData.push_back(pixel.b);
-				rawData.push_back(pixel.a);
+			else if (std::isspace(bytes[position])) {
+				++position;
+			}
+			else {
+				break;
 			}
 		}
-	}
-	return rawData;
-}
-
-void ImageData::saveImage(const char* outputFile, ImageFormat format, int quality)
-{
-	int outputChannels = static_cast<int>(channelCount(format));
-	auto rawData = packPixelData(pixels, width, height, format);
+	};
+	auto readToken = [&]()
+	{
+		skipSpace();
+		std::string token;
+		while (position < buffer.size() && !std::isspace(bytes[position])) {
+			token.push_back(static_cast<char>(bytes[position++]));
+		}
+		return token;
+	};
+	auto readNumber = [&]()
+	{
+		std::string token = readToken();
+		if (token.empty() || token.size() > 9 || !std::all_of(token.begin(), token.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+			throw std::runtime_error("Invalid image header");
+		}
+		return std::stoi(token);
+	};
+
+	int& maxValue = header.maxValue;
+	if (format == FileFormat::PNM)
+	{
+		header.channels = bytes[1] == '5' ? 1 : 3;
+		header.width = readNumber();
+		header.height = readNumber();
+		maxValue = readNumber();
+		// Exactly one whitespace byte separates the header from the samples
+		header.dataOffset = position + 1;
+	}
+	else if (format == FileFormat::PAM)
+	{
+		for (std::string key = readToken(); key != "ENDHDR"; key = readToken())
+		{
+			if (key == "WIDTH") header.width = readNumber();
+			else if (key == "HEIGHT") header.height = readNumber();
+			else if (key == "DEPTH") header.channels = readNumber();
+			else if (key == "MAXVAL") maxValue = readNumber();
+			else if (key == "TUPLTYPE") readToken();
+			else throw std::runtime_error("Invalid image header");
+		}
+		header.dataOffset = position + 1;
+	}
+	else if (format == FileFormat::Raw)
+	{
+		if (buffer.size() < rawHeaderBytes) {
+			throw std::runtime_error("Truncated image data");
+		}
+		auto field = [&](size_t offset)
+		{
+			std::uint32_t value = bytes[offset] | bytes[offset + 1] << 8 | bytes[offset + 2] << 16 | static_cast<std::uint32_t>(bytes[offset + 3]) << 24;
+			if (value > static_cast<std::uint32_t>(std::numeric_limits<int>::max())) {
+				throw std::runtime_error("Invalid image header");
+			}
+			return static_cast<int>(value);
+		};
+		header.width = field(4);
+		header.height = field(8);
+		header.channels = field(12);
+		header.dataOffset = rawHeaderBytes;
+	}
+	else
+	{
+		return header;
+	}
+
+	// 16-bit PNM is left to stb_image, which reduces it to 8 bits
+	if (format == FileFormat::PNM && maxValue > 255) {
+		return {};
+	}
+	if (header.width <= 0 || header.height <= 0 || header.channels < 1 || header.channels > 4 || maxValue < 1 || maxValue > 255) {
+		throw std::runtime_error("Unsupported image header");
+	}
+	size_t dataBytes = static_cast<size_t>(header.width) * header.height * header.channels;
+	if (checkPayload && (header.dataOffset > buffer.size() || buffer.size() - header.dataOffset < dataBytes)) {
+		throw std::runtime_error("Truncated image data");
+	}
+	header.format = format;
+	return header;
+}
 
-	int stride = width * pixelChannels;
+void ImageData::loadRegion(const char* inputFile, const Rect& region)
+{
+	// Tiles are visited out of file order, so skip the sequential read-ahead
+	MappedFile file(inputFile, FileAccess::Random);
+	loadRegion(file.bytes(), region);
+}
 
-	bool success = false;
+void ImageData::loadRegion(std::span<const std::byte> buffer, const Rect& region)
+{
+	if (detectFileFormat(buffer) != FileFormat::Tiled) {
+		throw std::invalid_argument("Region reads need a tiled image");
+	}
+	assignTiled(TiledImageReader(buffer), region);
+}
+
+ImageInfo ImageData::probe(std::span<const std::byte> buffer)
+{
+	// Header-only parses: neither the pixel payload nor the tile index has to be in the buffer
+	if (detectFileFormat(buffer) == FileFormat::Tiled)
+	{
+		TiledHeader header = readTiledHeader(buffer);
+		return { header.width, header.height, pixelChannels, 8, FileFormat::Tiled };
+	}
+	InterchangeHeader header = readInterchangeHeader(buffer, false);
+	if (header.format != FileFormat::Unknown) {
+		return { header.width, header.height, header.channels, 8, header.format };
+	}
+	ImageInfo info;
+	const stbi_uc* data = reinterpret_cast<const stbi_uc*>(buffer.data());
+	int length = static_cast<int>(buffer.size());
+	if (!decodableSize(buffer) || !stbi_info_from_memory(data, length, &info.width, &info.height, &info.channels)) {
+		throw std::runtime_error("Failed to read image header");
+	}
+	info.bitDepth = stbi_is_hdr_from_memory(data, length) ? 32 : stbi_is_16_bit_from_memory(data, length) ? 16 : 8;
+	info.format = detectFileFormat(buffer);
+	return info;
+}
+
+void ImageData::assignPixelData(const unsigned char* data, int w, int h, int fileChannels, int dataChannels,
+	const std::array<unsigned char, 256>* lut)
+{
+	width = w;
+	height = h;
+	channels = fileChannels;
+	pixels.assign(height, std::vector<Pixel>(width));
+	auto copyRows = [&](int y0, int y1, auto sample)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			const unsigned char* row = data + static_cast<size_t>(y) * width * dataChannels;
+			if (dataChannels == pixelChannels && !lut)
+			{
+				std::memcpy(pixels[y].data(), row, static_cast<size_t>(width) * sizeof(Pixel));
+				continue;
+			}
+			for (Pixel& pixel : pixels[y])
+			{
+				switch (dataChannels)
+				{
+				case 1: pixel = { sample(row[0]), sample(row[0]), sample(row[0]), 255 }; break;
+				case 2: pixel = { sample(row[0]), sample(row[0]), sample(row[0]), sample(row[1]) }; break;
+				case 3: pixel = { sample(row[0]), sample(row[1]), sample(row[2]), 255 }; break;
+				default: pixel = { sample(row[0]), sample(row[1]), sample(row[2]), sample(row[3]) }; break;
+				}
+				row += dataChannels;
+			}
+		}
+	};
+	parallelRows(height, [&](int y0, int y1)
+	{
+		if (lut) {
+			copyRows(y0, y1, [lut](unsigned char value) { return (*lut)[value]; });
+		}
+		else {
+			copyRows(y0, y1, [](unsigned char value) { return value; });
+		}
+	});
+}
+
+void ImageData::assignTiled(const TiledImageReader& reader, const Rect& region)
+{
+	Rect area = intersect({ 0, 0, reader.getWidth(), reader.getHeight() }, region);
+	if (area.empty()) {
+		throw std::invalid_argument("Region outside the image");
+	}
+	width = area.width;
+	height = area.height;
+	channels = pixelChannels;
+	pixels.assign(height, std::vector<Pixel>(width));
+	std::vector<unsigned char*> rows(height);
+	for (int y = 0; y < height; ++y) {
+		rows[y] = reinterpret_cast<unsigned char*>(pixels[y].data());
+	}
+	reader.readRegion(area.x, area.y, area.width, area.height, rows.data());
+}
+
+bool ImageData::assignInterchange(std::span<const std::byte> buffer)
+{
+	InterchangeHeader header = readInterchangeHeader(buffer);
+	if (header.format == FileFormat::Unknown) {
+		return false;
+	}
+	const unsigned char* samples = reinterpret_cast<const unsigned char*>(buffer.data()) + header.dataOffset;
+	if (header.maxValue == 255)
+	{
+		assignPixelData(samples, header.width, header.height, header.channels, header.channels);
+		return true;
+	}
+	// Rescaled inside the banded row copy; out-of-range samples clamp to white
+	LookupTable lut{};
+	for (int i = 0; i < 256; ++i) {
+		lut[i] = static_cast<unsigned char>(std::min(255, (i * 255 + header.maxValue / 2) / header.maxValue));
+	}
+	assignPixelData(samples, header.width, header.height, header.channels, header.channels, &lut);
+	return true;
+}
+
+constexpr const char* toString(ImageFormat format)
+{
 	switch (format)
 	{
 	case ImageFormat::PNG:
-		std::cout << "Saving PNG image...\n";
-		success = static_cast<bool>(stbi_write_png(outputFile, width, height, outputChannels, rawData.data(), stride));
-		break;
+		return "PNG";
 	case ImageFormat::JPG:
-		std::cout << "Saving JPG image...\n";
-		success = static_cast<bool>(stbi_write_jpg(outputFile, width, height, outputChannels, rawData.data(), quality));
-		break;
+		return "JPG";
 	case ImageFormat::BMP:
-		std::cout << "Saving BMP image...\n";
-		success = static_cast<bool>(stbi_write_bmp(outputFile, width, height, outputChannels, rawData.data()));
-		break;
+		return "BMP";
+	case ImageFormat::IndexedPNG:
+		return "indexed PNG";
+	case ImageFormat::PPM:
+		return "PPM";
+	case ImageFormat::PAM:
+		return "PAM";
+	case ImageFormat::Raw:
+		return "raw";
+	case ImageFormat::Tiled:
+		return "tiled";
+	default:
+		return "unknown";
 	}
+}
 
-	if (!success) {
-		throw std::runtime_error("Failed to save image");
+constexpr ColorChannel channelCount(ImageFormat format)
+{
+	switch (format)
+	{
+	case ImageFormat::PNG:
+		return ColorChannel::RGBA;
+	case ImageFormat::JPG:
+		return ColorChannel::RGB;
+	case ImageFormat::BMP:
+		return ColorChannel::RGB;
+	case ImageFormat::IndexedPNG:
+		return ColorChannel::G;
+	case ImageFormat::PPM:
+		return ColorChannel::RGB;
+	case ImageFormat::PAM:
+		return ColorChannel::RGBA;
+	case ImageFormat::Raw:
+		return ColorChannel::RGBA;
+	case ImageFormat::Tiled:
+		return ColorChannel::RGBA;
+	default:
+		return ColorChannel::Invalid;
 	}
 }
 
-// Monochrome and Tone functions
-// ------------------------------------------------------------------------------------
-
-void ImageData::grayscale()
+std::vector<unsigned char> packPixelData(const Vector2D<Pixel>& pixels, int width, int height, ImageFormat format)
 {
-	unsigned char grayValue{};
+	ColorChannel colorChannel = channelCount(format);
+	std::vector<unsigned char> rawData;
+	rawData.reserve(width * height * static_cast<int>(colorChannel));
+
 	for (int y = 0; y < height; ++y)
 	{
 		for (int x = 0; x < width; ++x)
 		{
-			Pixel& pixel = pixels[y][x];
-			grayValue = static_cast<unsigned char>(0.299f * pixel.r + 0.587f * pixel.g + 0.114f * pixel.b);
-			pixel.r = grayValue;
-			pixel.g = grayValue;
-			pixel.b = grayValue;
+			const Pixel& pixel = pixels[y][x];
+			if (colorChannel == ColorChannel::RGB) {
+				rawData.push_back(pixel.r);
+				rawData.push_back(pixel.g);
+				rawData.push_back(pixel.b);
+			}
+			if (colorChannel == ColorChannel::RGBA) {
+				rawData.push_back(pixel.r);
+				rawData.push_back(pixel.g);
+				rawData.push_back(pixel.b);
+				rawData.push_back(pixel.a);
+			}
 		}
 	}
+	return rawData;
 }
 
-void ImageData::threshold(unsigned char thresholdValue)
+template <typename T>
+PlanarImage<T> loadPlanarImage(const char* inputFile)
 {
-	unsigned char grayValue{};
-	for (int y = 0; y < height; ++y)
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	T* data = nullptr;
+	std::vector<float> scaled;
 	{
-		for (int x = 0; x < width; ++x)
+		MappedFile file(inputFile);
+		std::span<const std::byte> bytes = file.bytes();
+		if (decodableSize(bytes))
 		{
-			Pixel& pixel = pixels[y][x];
-			grayValue = static_cast<unsigned char>(0.299f * pixel.r + 0.587f * pixel.g + 0.114f * pixel.b);
-			if (grayValue < thresholdValue)
-			{
-				pixel.r = pixel.g = pixel.b = 0;
+			const stbi_uc* buffer = reinterpret_cast<const stbi_uc*>(bytes.data());
+			int length = static_cast<int>(bytes.size());
+			if constexpr (std::is_same_v<T, unsigned char>) {
+				data = stbi_load_from_memory(buffer, length, &width, &height, &channels, pixelChannels);
+			}
+			else if constexpr (std::is_same_v<T, std::uint16_t>) {
+				data = stbi_load_16_from_memory(buffer, length, &width, &height, &channels, pixelChannels);
+			}
+			else if (stbi_is_hdr_from_memory(buffer, length)) {
+				data = stbi_loadf_from_memory(buffer, length, &width, &height, &channels, pixelChannels);
 			}
 			else
 			{
-				pixel.r = pixel.g = pixel.b = 255;
+				// stbi_loadf would linearise LDR files with a fixed 2.2 gamma; keep their encoded values instead
+				std::uint16_t* wide = stbi_load_16_from_memory(buffer, length, &width, &height, &channels, pixelChannels);
+				if (wide)
+				{
+					scaled.resize(static_cast<size_t>(width) * height * pixelChannels);
+					for (size_t i = 0; i < scaled.size(); ++i) {
+						scaled[i] = wide[i] / PlaneTraits<std::uint16_t>::maxValue;
+					}
+					stbi_image_free(wide);
+					data = scaled.data();
+				}
+			}
+		}
+	}
+	if (!data)
+	{
+		throw std::runtime_error("Failed to load image");
+	}
+
+	PlanarImage<T> image(width, height);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			const T* source = data + static_cast<size_t>(y) * width * pixelChannels;
+			for (int c = 0; c < pixelChannels; ++c)
+			{
+				T* target = image.row(c, y);
+				for (int x = 0; x < width; ++x) {
+					target[x] = source[x * pixelChannels + c];
+				}
 			}
 		}
+	});
+	if (scaled.empty()) {
+		stbi_image_free(data);
 	}
+	return image;
 }
 
-void ImageData::invert()
+// Creates an empty temporary next to target, named by process, thread and a counter. The file
+// is created exclusively ("x" mode), so no other save and no existing file is ever reused.
+std::filesystem::path createTemporaryFile(const std::filesystem::path& target)
 {
-	for (int y = 0; y < height; ++y)
+	static std::atomic<std::uint64_t> counter{ 0 };
+#ifdef _WIN32
+	unsigned long process = GetCurrentProcessId();
+#else
+	long process = static_cast<long>(::getpid());
+#endif
+	std::string prefix = target.string() + "." + std::to_string(process) + "-"
+		+ std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "-";
+	for (int attempt = 0; attempt < 100; ++attempt)
 	{
-		for (int x = 0; x < width; ++x)
+		std::filesystem::path candidate(prefix + std::to_string(counter++) + ".tmp");
+		if (std::FILE* file = std::fopen(candidate.string().c_str(), "wbx"))
 		{
-			Pixel& pixel = pixels[y][x];
-			pixel.r = 255 - pixel.r;
-			pixel.g = 255 - pixel.g;
-			pixel.b = 255 - pixel.b;
+			std::fclose(file);
+			return candidate;
+		}
+		if (std::filesystem::exists(candidate)) {
+			continue;
 		}
+		break;
 	}
+	throw std::runtime_error("Failed to save image");
 }
 
-// Color Adjustment Functions
-// ------------------------------------------------------------------------------------
+// Writes through a unique temporary file and renames it into place, so a failed encode or write
+// never truncates an existing file and concurrent saves to one path never mix their bytes
+void writeFileAtomically(const char* outputFile, const std::function<void(std::ofstream&)>& write)
+{
+	std::filesystem::path target(outputFile);
+	std::filesystem::path temporary = createTemporaryFile(target);
+	try
+	{
+		std::ofstream file(temporary, std::ios::binary);
+		if (!file) {
+			throw std::runtime_error("Failed to save image");
+		}
+		write(file);
+		file.close();
+		if (!file) {
+			throw std::runtime_error("Failed to save image");
+		}
+		std::filesystem::rename(temporary, target);
+	}
+	catch (...)
+	{
+		std::error_code ignored;
+		std::filesystem::remove(temporary, ignored);
+		throw;
+	}
+}
 
-void ImageData::brightness(int offset)
+void savePlanarImage(const PlanarImage<std::uint16_t>& image, const char* outputFile, const PngOptions& options)
 {
-	for (int y = 0; y < height; ++y)
+	std::cout << "Saving 16-bit PNG image...\n";
+	std::vector<std::uint16_t> samples(static_cast<size_t>(image.width) * image.height * pixelChannels);
+	for (int y = 0; y < image.height; ++y)
 	{
-		for (int x = 0; x < width; ++x)
+		std::uint16_t* target = samples.data() + static_cast<size_t>(y) * image.width * pixelChannels;
+		for (int c = 0; c < pixelChannels; ++c)
 		{
-			Pixel& pixel = pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::clamp(pixel.r + offset, 0, 255));
-			pixel.g = static_cast<unsigned char>(std::clamp(pixel.g + offset, 0, 255));
-			pixel.b = static_cast<unsigned char>(std::clamp(pixel.b + offset, 0, 255));
+			const std::uint16_t* source = image.row(c, y);
+			for (int x = 0; x < image.width; ++x) {
+				target[x * pixelChannels + c] = source[x];
+			}
 		}
 	}
+	std::vector<unsigned char> png = encodeRgba16Png(samples.data(), image.width, image.height, options);
+	writeFileAtomically(outputFile, [&png](std::ofstream& file)
+	{
+		file.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+	});
 }
 
-void ImageData::contrast(float factor)
+template <typename To, typename From>
+PlanarImage<To> convertPlanes(const PlanarImage<From>& image)
 {
-	for (int y = 0; y < height; ++y)
+	if (image.space != ColorSpace::RGB) {
+		throw std::invalid_argument("Planes must hold RGB data");
+	}
+	PlanarImage<To> result(image.width, image.height);
+	constexpr float scale = PlaneTraits<To>::maxValue / PlaneTraits<From>::maxValue;
+	constexpr float round = std::is_floating_point_v<To> ? 0.0f : 0.5f;
+	for (int c = 0; c < pixelChannels; ++c)
 	{
-		for (int x = 0; x < width; ++x)
+		parallelRows(image.height, [&](int y0, int y1)
 		{
-			Pixel& pixel = pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.r * factor), 0, 255));
-			pixel.g = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.g * factor), 0, 255));
-			pixel.b = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.b * factor), 0, 255));
-		}
+			const From* source = image.row(c, y0);
+			To* target = result.row(c, y0);
+			size_t count = static_cast<size_t>(y1 - y0) * image.width;
+			for (size_t i = 0; i < count; ++i) {
+				target[i] = toSample<To>(source[i] * scale + round);
+			}
+		});
 	}
+	return result;
 }
 
-void ImageData::tint(const Pixel& color, float strength)
+// Palette of the image's distinct RGBA colours in first-seen order, plus one index per pixel
+std::vector<unsigned char> encodeIndexedImage(const Vector2D<Pixel>& pixels, int width, int height, const PngOptions& options)
 {
+	std::unordered_map<std::uint32_t, unsigned char> lookup;
+	std::vector<unsigned char> palette;
+	std::vector<unsigned char> indices(static_cast<size_t>(width) * height);
 	for (int y = 0; y < height; ++y)
 	{
 		for (int x = 0; x < width; ++x)
 		{
-			Pixel& pixel = pixels[y][x];
-			pixel.r = static_cast<unsigned char>(pixel.r * (1 - strength) + color.r * strength);
-			pixel.g = static_cast<unsigned char>(pixel.g * (1 - strength) + color.g * strength);
-			pixel.b = static_cast<unsigned char>(pixel.b * (1 - strength) + color.b * strength);
+			const Pixel& pixel = pixels[y][x];
+			std::uint32_t key = static_cast<std::uint32_t>(pixel.r) | (pixel.g << 8) | (pixel.b << 16) | (static_cast<std::uint32_t>(pixel.a) << 24);
+			auto found = lookup.find(key);
+			if (found == lookup.end())
+			{
+				if (lookup.size() == 256) {
+					throw std::invalid_argument("Image has more than 256 colours; quantize it before saving as IndexedPNG");
+				}
+				found = lookup.emplace(key, static_cast<unsigned char>(lookup.size())).first;
+				palette.insert(palette.end(), { pixel.r, pixel.g, pixel.b, pixel.a });
+			}
+			indices[static_cast<size_t>(y) * width + x] = found->second;
 		}
 	}
+	return encodeIndexedPng(indices.data(), width, height, palette.data(), static_cast<int>(lookup.size()), options);
 }
 
-void ImageData::noise(float intensity)
+void ImageData::saveImage(const char* outputFile, ImageFormat format, int quality, const PngOptions& png)
 {
-	for (int y = 0; y < height; ++y)
+	std::cout << "Saving " << ::toString(format) << " image...\n";
+	writeFileAtomically(outputFile, [&](std::ofstream& file)
 	{
-		for (int x = 0; x < width; ++x)
+		encodeTo(format, [&file](const std::byte* data, size_t size)
 		{
-			Pixel& pixel = pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.r + (rand() % 256 - 128) * intensity), 0, 255));
-			pixel.g = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.g + (rand() % 256 - 128) * intensity), 0, 255));
-			pixel.b = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.b + (rand() % 256 - 128) * intensity), 0, 255));
+			file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+		}, quality, png);
+	});
+}
+
+void ImageData::encodeTo(ImageFormat format, const EncodeSink& sink, int quality, const PngOptions& png) const
+{
+	int outputChannels = static_cast<int>(channelCount(format));
+	std::vector<unsigned char> rawData;
+	if (format == ImageFormat::JPG || format == ImageFormat::BMP) {
+		rawData = packPixelData(pixels, width, height, format);
+	}
+
+	// stb_image_write hands encoded chunks to a C callback; the context is the sink itself
+	stbi_write_func* write = [](void* context, void* data, int size)
+	{
+		(*static_cast<const EncodeSink*>(context))(static_cast<const std::byte*>(data), static_cast<size_t>(size));
+	};
+	void* context = const_cast<EncodeSink*>(&sink);
+
+	bool success = false;
+	switch (format)
+	{
+	case ImageFormat::PNG:
+		streamPng(sink, png);
+		success = true;
+		break;
+	case ImageFormat::JPG:
+		success = static_cast<bool>(stbi_write_jpg_to_func(write, context, width, height, outputChannels, rawData.data(), quality));
+		break;
+	case ImageFormat::BMP:
+		success = static_cast<bool>(stbi_write_bmp_to_func(write, context, width, height, outputChannels, rawData.data()));
+		break;
+	case ImageFormat::IndexedPNG:
+	{
+		std::vector<unsigned char> encoded = encodeIndexedImage(pixels, width, height, png);
+		sink(reinterpret_cast<const std::byte*>(encoded.data()), encoded.size());
+		success = true;
+		break;
+	}
+	case ImageFormat::PPM:
+	case ImageFormat::PAM:
+	case ImageFormat::Raw:
+		writeInterchange(format, sink);
+		success = true;
+		break;
+	case ImageFormat::Tiled:
+	{
+		std::vector<const unsigned char*> rows(height);
+		for (int y = 0; y < height; ++y) {
+			rows[y] = reinterpret_cast<const unsigned char*>(pixels[y].data());
 		}
+		std::vector<unsigned char> encoded = encodeTiledImage(rows.data(), width, height);
+		sink(reinterpret_cast<const std::byte*>(encoded.data()), encoded.size());
+		success = true;
+		break;
+	}
+	}
+
+	if (!success) {
+		throw std::runtime_error("Failed to encode image");
+	}
+}
+
+constexpr Pixel straightAlpha(Pixel pixel)
+{
+	if (pixel.a == 0) {
+		return { 0, 0, 0, 0 };
+	}
+	int half = pixel.a / 2;
+	pixel.r = static_cast<unsigned char>(std::min(255, (pixel.r * 255 + half) / pixel.a));
+	pixel.g = static_cast<unsigned char>(std::min(255, (pixel.g * 255 + half) / pixel.a));
+	pixel.b = static_cast<unsigned char>(std::min(255, (pixel.b * 255 + half) / pixel.a));
+	return pixel;
+}
+
+void ImageData::streamPng(const EncodeSink& sink, const PngOptions& options) const
+{
+	PngStreamEncoder::Sink write = [&sink](const unsigned char* data, size_t size)
+	{
+		sink(reinterpret_cast<const std::byte*>(data), size);
+	};
+	// Packed RGBA pixel rows already are PNG scanlines
+	PngStreamEncoder encoder(width, height, static_cast<int>(channelCount(ImageFormat::PNG)), write, options);
+	std::vector<const unsigned char*> rows(height);
+	for (int y = 0; y < height; ++y) {
+		rows[y] = reinterpret_cast<const unsigned char*>(pixels[y].data());
 	}
+	encoder.writeRows(rows.data(), height);
+	encoder.finish();
 }
 
-// Geomoetry Functions
-// ------------------------------------------------------------------------------------
+void ImageData::writeInterchange(ImageFormat format, const EncodeSink& sink) const
+{
+	std::string header;
+	switch (format)
+	{
+	case ImageFormat::PPM:
+		header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		break;
+	case ImageFormat::PAM:
+		header = "P7\nWIDTH " + std::to_string(width) + "\nHEIGHT " + std::to_string(height) + "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+		break;
+	default:
+	{
+		header = "IRAW";
+		for (std::uint32_t value : { static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height), static_cast<std::uint32_t>(pixelChannels) })
+		{
+			for (int shift = 0; shift < 32; shift += 8) {
+				header.push_back(static_cast<char>((value >> shift) & 0xFF));
+			}
+		}
+		break;
+	}
+	}
+	sink(reinterpret_cast<const std::byte*>(header.data()), header.size());
+
+	int outputChannels = static_cast<int>(channelCount(format));
+	std::vector<unsigned char> row;
+	for (int y = 0; y < height; ++y)
+	{
+		if (outputChannels == pixelChannels)
+		{
+			sink(reinterpret_cast<const std::byte*>(pixels[y].data()), pixels[y].size() * sizeof(Pixel));
+			continue;
+		}
+		row.resize(static_cast<size_t>(width) * outputChannels);
+		unsigned char* out = row.data();
+		for (const Pixel& pixel : pixels[y])
+		{
+			*out++ = pixel.r;
+			*out++ = pixel.g;
+			*out++ = pixel.b;
+			if (outputChannels == pixelChannels) {
+				*out++ = pixel.a;
+			}
+		}
+		sink(reinterpret_cast<const std::byte*>(row.data()), row.size());
+	}
+}
+
+std::vector<std::byte> ImageData::encodeTo(ImageFormat format, int quality, const PngOptions& png) const
+{
+	std::vector<std::byte> encoded;
+	encodeTo(format, [&encoded](const std::byte* data, size_t size)
+	{
+		encoded.insert(encoded.end(), data, data + size);
+	}, quality, png);
+	return encoded;
+}
+
+// Integral Image Functions
+// ------------------------------------------------------------------------------------
+
+// True when every clipped boxW x boxH box of 8-bit samples sums exactly in 32 bits
+inline bool fitsUint32Box(const ImageData& image, int boxW, int boxH)
+{
+	std::uint64_t area = static_cast<std::uint64_t>(std::min(boxW, image.getWidth())) * std::min(boxH, image.getHeight());
+	return area * 255 <= std::numeric_limits<std::uint32_t>::max();
+}
+
+template <typename Sum>
+IntegralImage<Sum>::IntegralImage(const ImageData& image, IntegralSource source, bool withSquares)
+	: width{ image.getWidth() }, height{ image.getHeight() }, channels{ source == IntegralSource::Luma ? 1 : pixelChannels }
+{
+	// One extra zero row and column so queries need no edge cases
+	size_t rowLength = static_cast<size_t>(width + 1) * channels;
+	sums.assign(rowLength * (height + 1), 0);
+	if (withSquares) {
+		squaredSums.assign(rowLength * (height + 1), 0);
+	}
+
+	std::array<Sum, pixelChannels> rowSum{};
+	std::array<Sum, pixelChannels> rowSquares{};
+	std::array<Sum, pixelChannels> values{};
+	for (int y = 0; y < height; ++y)
+	{
+		rowSum = {};
+		rowSquares = {};
+		size_t above = static_cast<size_t>(y) * rowLength;
+		size_t current = above + rowLength;
+		for (int x = 0; x < width; ++x)
+		{
+			const Pixel& pixel = image.getPixel(y, x);
+			if (channels == 1) {
+				values[0] = luma(pixel);
+			}
+			else {
+				values = { pixel.r, pixel.g, pixel.b, pixel.a };
+			}
+			size_t offset = static_cast<size_t>(x + 1) * channels;
+			for (int c = 0; c < channels; ++c)
+			{
+				rowSum[c] += values[c];
+				sums[current + offset + c] = sums[above + offset + c] + rowSum[c];
+				if (withSquares)
+				{
+					rowSquares[c] += values[c] * values[c];
+					squaredSums[current + offset + c] = squaredSums[above + offset + c] + rowSquares[c];
+				}
+			}
+		}
+	}
+}
+
+template <typename Sum>
+Sum IntegralImage<Sum>::query(const std::vector<Sum>& table, const Rect& box, int channel) const
+{
+	if (channel < 0 || channel >= channels) {
+		throw std::out_of_range("Integral image channel out of range");
+	}
+	Rect area = intersect(box, { 0, 0, width, height });
+	if (area.empty()) {
+		return 0;
+	}
+	size_t rowLength = static_cast<size_t>(width + 1) * channels;
+	size_t top = static_cast<size_t>(area.y) * rowLength;
+	size_t bottom = static_cast<size_t>(area.y + area.height) * rowLength;
+	size_t left = static_cast<size_t>(area.x) * channels + channel;
+	size_t right = static_cast<size_t>(area.x + area.width) * channels + channel;
+	return table[bottom + right] - table[bottom + left] - table[top + right] + table[top + left];
+}
+
+template <typename Sum>
+Sum IntegralImage<Sum>::boxSquaredSum(const Rect& box, int channel) const
+{
+	if (squaredSums.empty()) {
+		throw std::logic_error("Integral image was built without squared sums");
+	}
+	return query(squaredSums, box, channel);
+}
+
+template <typename Sum>
+double IntegralImage<Sum>::boxMean(const Rect& box, int channel) const
+{
+	Rect area = intersect(box, { 0, 0, width, height });
+	if (area.empty()) {
+		return 0.0;
+	}
+	return static_cast<double>(boxSum(area, channel)) / (static_cast<double>(area.width) * area.height);
+}
+
+template <typename Sum>
+double IntegralImage<Sum>::boxVariance(const Rect& box, int channel) const
+{
+	Rect area = intersect(box, { 0, 0, width, height });
+	if (area.empty()) {
+		return 0.0;
+	}
+	double count = static_cast<double>(area.width) * area.height;
+	double mean = static_cast<double>(boxSum(area, channel)) / count;
+	return std::max(0.0, static_cast<double>(boxSquaredSum(area, channel)) / count - mean * mean);
+}
+
+// Monochrome and Tone functions
+// ------------------------------------------------------------------------------------
+
+void ImageData::grayscale()
+{
+	unsigned char grayValue{};
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Pixel& pixel = pixels[y][x];
+			grayValue = static_cast<unsigned char>(0.299f * pixel.r + 0.587f * pixel.g + 0.114f * pixel.b);
+			pixel.r = grayValue;
+			pixel.g = grayValue;
+			pixel.b = grayValue;
+		}
+	}
+}
+
+void ImageData::threshold(unsigned char thresholdValue)
+{
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			for (Pixel& pixel : pixels[y])
+			{
+				if (luma(pixel) < thresholdValue)
+				{
+					pixel.r = pixel.g = pixel.b = 0;
+				}
+				else
+				{
+					pixel.r = pixel.g = pixel.b = 255;
+				}
+			}
+		}
+	});
+}
+
+unsigned char ImageData::thresholdOtsu()
+{
+	Histogram bins = histogram(HistogramChannel::Luma);
+	double total = 0.0;
+	double weightedTotal = 0.0;
+	for (int i = 0; i < 256; ++i)
+	{
+		total += bins[i];
+		weightedTotal += static_cast<double>(i) * bins[i];
+	}
+
+	// Class 0 is [0, t], class 1 is (t, 255]
+	double background = 0.0;
+	double weightedBackground = 0.0;
+	double bestVariance = -1.0;
+	int best = 0;
+	for (int t = 0; t < 255; ++t)
+	{
+		background += bins[t];
+		weightedBackground += static_cast<double>(t) * bins[t];
+		double foreground = total - background;
+		if (background == 0.0 || foreground == 0.0) {
+			continue;
+		}
+		double meanDifference = weightedBackground / background - (weightedTotal - weightedBackground) / foreground;
+		double variance = background * foreground * meanDifference * meanDifference;
+		if (variance > bestVariance)
+		{
+			bestVariance = variance;
+			best = t;
+		}
+	}
+
+	unsigned char thresholdValue = static_cast<unsigned char>(best + 1);
+	threshold(thresholdValue);
+	return thresholdValue;
+}
+
+void ImageData::adaptiveThreshold(int blockSize, int offset)
+{
+	if (blockSize <= 0) {
+		throw std::invalid_argument("Invalid input");
+	}
+	int radius = blockSize / 2;
+	int window = 2 * radius + 1;
+
+	auto threshold = [&](const auto& integral)
+	{
+		parallelRows(height, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					Rect box = intersect(bounds(), { x - radius, y - radius, window, window });
+					std::int64_t sum = static_cast<std::int64_t>(integral.boxSum(box));
+					std::int64_t area = static_cast<std::int64_t>(box.width) * box.height;
+
+					// luma > mean - offset, kept in integers as luma * area > sum - offset * area
+					Pixel& pixel = pixels[y][x];
+					std::int64_t lhs = luma(pixel) * area;
+					std::int64_t rhs = sum - offset * area;
+					pixel.r = pixel.g = pixel.b = lhs > rhs ? 255 : 0;
+				}
+			}
+		});
+	};
+	// 32-bit sums halve the table when no window can reach 2^32
+	if (fitsUint32Box(*this, window, window)) {
+		threshold(IntegralImage<std::uint32_t>(*this, IntegralSource::Luma));
+	}
+	else {
+		threshold(IntegralImage<std::uint64_t>(*this, IntegralSource::Luma));
+	}
+}
+
+void ImageData::ditherOrdered(int bayerN)
+{
+	if (bayerN < 2 || bayerN > 16 || (bayerN & (bayerN - 1)) != 0) {
+		throw std::invalid_argument("Bayer matrix size must be 2, 4, 8 or 16");
+	}
+
+	// Recursive Bayer construction: M(2n) = [4M + 0, 4M + 2; 4M + 3, 4M + 1]
+	std::vector<int> bayer{ 0 };
+	for (int n = 1; n < bayerN; n *= 2)
+	{
+		std::vector<int> next(4 * n * n);
+		for (int y = 0; y < n; ++y)
+		{
+			for (int x = 0; x < n; ++x)
+			{
+				int v = 4 * bayer[y * n + x];
+				next[y * 2 * n + x] = v;
+				next[y * 2 * n + x + n] = v + 2;
+				next[(y + n) * 2 * n + x] = v + 3;
+				next[(y + n) * 2 * n + x + n] = v + 1;
+			}
+		}
+		bayer = std::move(next);
+	}
+
+	// Cell thresholds spread evenly over (0, 255)
+	int cells = bayerN * bayerN;
+	std::vector<unsigned char> thresholds(cells);
+	for (int i = 0; i < cells; ++i)
+	{
+		thresholds[i] = static_cast<unsigned char>((2 * bayer[i] + 1) * 255 / (2 * cells));
+	}
+
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			const unsigned char* row = thresholds.data() + (y & (bayerN - 1)) * bayerN;
+			for (int x = 0; x < width; ++x)
+			{
+				Pixel& pixel = pixels[y][x];
+				pixel.r = pixel.g = pixel.b = luma(pixel) > row[x & (bayerN - 1)] ? 255 : 0;
+			}
+		}
+	});
+}
+
+// Rows are dealt round-robin to the workers. A row may process pixel x once the row above has
+// finished x + wavefrontLag - 1: that guarantees it has received all error from above and that
+// the two rows never write the same error cell (Atkinson reaches two pixels right and two rows down).
+constexpr int wavefrontLag{ 4 };
+
+template <typename Diffuse>
+void ImageData::diffuseError(Diffuse diffuse)
+{
+	std::vector<int> values(static_cast<size_t>(width) * height);
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			values[static_cast<size_t>(y) * width + x] = luma(pixels[y][x]);
+		}
+	}
+
+	std::vector<std::atomic<int>> progress(height);
+	for (auto& done : progress) {
+		done.store(0, std::memory_order_relaxed);
+	}
+	int workers = std::min(workerCount(), std::max(1, height));
+	parallelFor(workers, [&](int worker)
+	{
+		for (int y = worker; y < height; y += workers)
+		{
+			int* row = values.data() + static_cast<size_t>(y) * width;
+			for (int x = 0; x < width; ++x)
+			{
+				if (y > 0)
+				{
+					int needed = std::min(x + wavefrontLag, width);
+					while (progress[y - 1].load(std::memory_order_acquire) < needed) {
+						std::this_thread::yield();
+					}
+				}
+				int value = row[x];
+				int quantized = value < 128 ? 0 : 255;
+				row[x] = quantized;
+				diffuse(values.data(), x, y, value - quantized);
+				progress[y].store(x + 1, std::memory_order_release);
+			}
+		}
+	});
+
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				Pixel& pixel = pixels[y][x];
+				pixel.r = pixel.g = pixel.b = static_cast<unsigned char>(values[static_cast<size_t>(y) * width + x]);
+			}
+		}
+	});
+}
+
+void ImageData::ditherFloydSteinberg()
+{
+	diffuseError([this](int* values, int x, int y, int error)
+	{
+		// 7/16 right, 3/16 down-left, 5/16 down, 1/16 down-right; the last share takes the rounding
+		int right = error * 7 / 16;
+		int downLeft = error * 3 / 16;
+		int down = error * 5 / 16;
+		int downRight = error - right - downLeft - down;
+		int* row = values + static_cast<size_t>(y) * width;
+		if (x + 1 < width) {
+			row[x + 1] += right;
+		}
+		if (y + 1 < height)
+		{
+			int* below = row + width;
+			if (x > 0) {
+				below[x - 1] += downLeft;
+			}
+			below[x] += down;
+			if (x + 1 < width) {
+				below[x + 1] += downRight;
+			}
+		}
+	});
+}
+
+void ImageData::ditherAtkinson()
+{
+	diffuseError([this](int* values, int x, int y, int error)
+	{
+		// 1/8 to six neighbours; the remaining 2/8 is deliberately dropped
+		int share = error / 8;
+		int* row = values + static_cast<size_t>(y) * width;
+		if (x + 1 < width) {
+			row[x + 1] += share;
+		}
+		if (x + 2 < width) {
+			row[x + 2] += share;
+		}
+		if (y + 1 < height)
+		{
+			int* below = row + width;
+			if (x > 0) {
+				below[x - 1] += share;
+			}
+			below[x] += share;
+			if (x + 1 < width) {
+				below[x + 1] += share;
+			}
+		}
+		if (y + 2 < height) {
+			row[static_cast<size_t>(2) * width + x] += share;
+		}
+	});
+}
+
+void ImageData::invert()
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Pixel& pixel = pixels[y][x];
+			pixel.r = 255 - pixel.r;
+			pixel.g = 255 - pixel.g;
+			pixel.b = 255 - pixel.b;
+		}
+	}
+}
+
+// Color Adjustment Functions
+// ------------------------------------------------------------------------------------
+
+void ImageData::brightness(int offset)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Pixel& pixel = pixels[y][x];
+			pixel.r = static_cast<unsigned char>(std::clamp(pixel.r + offset, 0, 255));
+			pixel.g = static_cast<unsigned char>(std::clamp(pixel.g + offset, 0, 255));
+			pixel.b = static_cast<unsigned char>(std::clamp(pixel.b + offset, 0, 255));
+		}
+	}
+}
+
+void ImageData::contrast(float factor)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Pixel& pixel = pixels[y][x];
+			pixel.r = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.r * factor), 0, 255));
+			pixel.g = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.g * factor), 0, 255));
+			pixel.b = static_cast<unsigned char>(std::clamp(static_cast<int>(pixel.b * factor), 0, 255));
+		}
+	}
+}
+
+void ImageData::tint(const Pixel& color, float strength)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			Pixel& pixel = pixels[y][x];
+			pixel.r = static_cast<unsigned char>(pixel.r * (1 - strength) + color.r * strength);
+			pixel.g = static_cast<unsigned char>(pixel.g * (1 - strength) + color.g * strength);
+			pixel.b = static_cast<unsigned char>(pixel.b * (1 - strength) + color.b * strength);
+		}
+	}
+}
+
+// SplitMix64 finaliser
+constexpr std::uint64_t mix64(std::uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Counter-based generator: 64 random bits for a given (key, counter) with no shared state,
+// so any pixel's noise can be generated on any thread in any order
+constexpr std::uint64_t counterRandom(std::uint64_t key, std::uint64_t counter)
+{
+	return mix64(key + (counter + 1) * 0x9E3779B97F4A7C15ull);
+}
+
+void ImageData::noise(float intensity, std::uint64_t seed)
+{
+	std::uint64_t key = mix64(seed);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			std::uint64_t counter = static_cast<std::uint64_t>(y) * width;
+			for (Pixel& pixel : pixels[y])
+			{
+				std::uint64_t bits = counterRandom(key, counter++);
+				auto apply = [intensity](unsigned char value, std::uint64_t byte)
+				{
+					return static_cast<unsigned char>(std::clamp(static_cast<int>(value + (static_cast<int>(byte & 0xFF) - 128) * intensity), 0, 255));
+				};
+				pixel.r = apply(pixel.r, bits);
+				pixel.g = apply(pixel.g, bits >> 8);
+				pixel.b = apply(pixel.b, bits >> 16);
+			}
+		}
+	});
+}
+
+void ImageData::gaussianNoise(float sigma, std::uint64_t seed)
+{
+	constexpr float twoPi = 6.28318530718f;
+	constexpr float inv32 = 1.0f / 4294967296.0f;
+	std::uint64_t key = mix64(seed);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			// Two counters per pixel give two Box-Muller pairs, three of which are used
+			std::uint64_t counter = static_cast<std::uint64_t>(y) * width * 2;
+			for (Pixel& pixel : pixels[y])
+			{
+				std::array<float, 4> normals{};
+				for (int pair = 0; pair < 2; ++pair)
+				{
+					std::uint64_t bits = counterRandom(key, counter++);
+					float u1 = (static_cast<float>(bits >> 32) + 1.0f) * inv32;
+					float u2 = static_cast<float>(bits & 0xFFFFFFFFu) * inv32;
+					float radius = sigma * std::sqrt(-2.0f * std::log(u1));
+					normals[pair * 2] = radius * std::cos(twoPi * u2);
+					normals[pair * 2 + 1] = radius * std::sin(twoPi * u2);
+				}
+				auto apply = [](unsigned char value, float offset)
+				{
+					return static_cast<unsigned char>(std::clamp(static_cast<int>(std::lround(value + offset)), 0, 255));
+				};
+				pixel.r = apply(pixel.r, normals[0]);
+				pixel.g = apply(pixel.g, normals[1]);
+				pixel.b = apply(pixel.b, normals[2]);
+			}
+		}
+	});
+}
+
+// Planar Layout Functions
+// ------------------------------------------------------------------------------------
+
+void deinterleavePixels(const Pixel* source, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGEDATA_SSE2
+	static_assert(sizeof(Pixel) == 4, "SSE2 planar path assumes packed RGBA pixels");
+	const __m128i low = _mm_set1_epi32(0xFF);
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i quads[4];
+		for (int k = 0; k < 4; ++k) {
+			quads[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 4 * k));
+		}
+		// Isolate one channel per 32-bit lane, then narrow 32 -> 16 -> 8 bits (no value exceeds 255)
+		auto channel = [&](int shift)
+		{
+			const __m128i count = _mm_cvtsi32_si128(shift);
+			__m128i c0 = _mm_and_si128(_mm_srl_epi32(quads[0], count), low);
+			__m128i c1 = _mm_and_si128(_mm_srl_epi32(quads[1], count), low);
+			__m128i c2 = _mm_and_si128(_mm_srl_epi32(quads[2], count), low);
+			__m128i c3 = _mm_and_si128(_mm_srl_epi32(quads[3], count), low);
+			return _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+		};
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(r + i), channel(0));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(g + i), channel(8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), channel(16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), channel(24));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		r[i] = source[i].r;
+		g[i] = source[i].g;
+		b[i] = source[i].b;
+		a[i] = source[i].a;
+	}
+}
+
+void interleavePixels(Pixel* target, const unsigned char* r, const unsigned char* g, const unsigned char* b, const unsigned char* a, size_t count)
+{
+	size_t i = 0;
+#ifdef IMAGEDATA_SSE2
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i vr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r + i));
+		__m128i vg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i rgLow = _mm_unpacklo_epi8(vr, vg);
+		__m128i rgHigh = _mm_unpackhi_epi8(vr, vg);
+		__m128i baLow = _mm_unpacklo_epi8(vb, va);
+		__m128i baHigh = _mm_unpackhi_epi8(vb, va);
+		__m128i* out = reinterpret_cast<__m128i*>(target + i);
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(rgLow, baLow));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+	}
+#endif
+	for (; i < count; ++i) {
+		target[i] = { r[i], g[i], b[i], a[i] };
+	}
+}
+
+PlanarImage<unsigned char> ImageData::unpackPlanes() const
+{
+	PlanarImage<unsigned char> planar(width, height);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y) {
+			deinterleavePixels(pixels[y].data(), planar.row(0, y), planar.row(1, y), planar.row(2, y), planar.row(3, y), width);
+		}
+	});
+	return planar;
+}
+
+void ImageData::packPlanes(const PlanarImage<unsigned char>& planar)
+{
+	if (planar.space != ColorSpace::RGB) {
+		throw std::invalid_argument("Planes must hold RGB data");
+	}
+	*this = ImageData(planar.width, planar.height);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y) {
+			interleavePixels(pixels[y].data(), planar.row(0, y), planar.row(1, y), planar.row(2, y), planar.row(3, y), width);
+		}
+	});
+}
+
+// Color Space Functions
+// ------------------------------------------------------------------------------------
+// Every converter works in place on three channel spans, one pixel at a time. The transfer
+// curves behind Lab call std::pow and std::cbrt per sample, so those loops are not vectorised.
+
+void rgbToHsv(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float r = c0[i], g = c1[i], b = c2[i];
+		float high = std::max(r, std::max(g, b));
+		float low = std::min(r, std::min(g, b));
+		float delta = high - low;
+		float inverse = delta > 0.0f ? 60.0f / delta : 0.0f;
+		float hue = high == r ? (g - b) * inverse : high == g ? (b - r) * inverse + 120.0f : (r - g) * inverse + 240.0f;
+		c0[i] = hue < 0.0f ? hue + 360.0f : hue;
+		c1[i] = high > 0.0f ? delta / high : 0.0f;
+		c2[i] = high;
+	}
+}
+
+void hsvToRgb(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float sector = c0[i] / 60.0f;
+		float chroma = c2[i] * c1[i];
+		auto channel = [&](float n)
+		{
+			float k = n + sector;
+			k -= 6.0f * std::floor(k / 6.0f);
+			return c2[i] - chroma * std::clamp(std::min(k, 4.0f - k), 0.0f, 1.0f);
+		};
+		float r = channel(5.0f), g = channel(3.0f), b = channel(1.0f);
+		c0[i] = r;
+		c1[i] = g;
+		c2[i] = b;
+	}
+}
+
+void rgbToHsl(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float r = c0[i], g = c1[i], b = c2[i];
+		float high = std::max(r, std::max(g, b));
+		float low = std::min(r, std::min(g, b));
+		float delta = high - low;
+		float inverse = delta > 0.0f ? 60.0f / delta : 0.0f;
+		float hue = high == r ? (g - b) * inverse : high == g ? (b - r) * inverse + 120.0f : (r - g) * inverse + 240.0f;
+		float lightness = (high + low) * 0.5f;
+		float denominator = 1.0f - std::abs(2.0f * lightness - 1.0f);
+		c0[i] = hue < 0.0f ? hue + 360.0f : hue;
+		c1[i] = denominator > 0.0f ? delta / denominator : 0.0f;
+		c2[i] = lightness;
+	}
+}
+
+void hslToRgb(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float sector = c0[i] / 30.0f;
+		float lightness = c2[i];
+		float amplitude = c1[i] * std::min(lightness, 1.0f - lightness);
+		auto channel = [&](float n)
+		{
+			float k = n + sector;
+			k -= 12.0f * std::floor(k / 12.0f);
+			return lightness - amplitude * std::clamp(std::min(k - 3.0f, 9.0f - k), -1.0f, 1.0f);
+		};
+		float r = channel(0.0f), g = channel(8.0f), b = channel(4.0f);
+		c0[i] = r;
+		c1[i] = g;
+		c2[i] = b;
+	}
+}
+
+void rgbToYCbCr(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float y = 0.299f * c0[i] + 0.587f * c1[i] + 0.114f * c2[i];
+		float cb = (c2[i] - y) * 0.564334f;
+		float cr = (c0[i] - y) * 0.713267f;
+		c0[i] = y;
+		c1[i] = cb;
+		c2[i] = cr;
+	}
+}
+
+void yCbCrToRgb(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float y = c0[i], cb = c1[i], cr = c2[i];
+		c0[i] = y + 1.402f * cr;
+		c1[i] = y - 0.344136f * cb - 0.714136f * cr;
+		c2[i] = y + 1.772f * cb;
+	}
+}
+
+inline float srgbToLinear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float linearToSrgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// CIE constants: epsilon = (6/29)^3, kappa = (29/3)^3
+constexpr float labEpsilon{ 216.0f / 24389.0f };
+constexpr float labKappa{ 24389.0f / 27.0f };
+
+inline float labForward(float t)
+{
+	return t > labEpsilon ? std::cbrt(t) : (labKappa * t + 16.0f) / 116.0f;
+}
+
+inline float labInverse(float f)
+{
+	float cube = f * f * f;
+	return cube > labEpsilon ? cube : (116.0f * f - 16.0f) / labKappa;
+}
+
+void rgbToLab(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float r = srgbToLinear(c0[i]), g = srgbToLinear(c1[i]), b = srgbToLinear(c2[i]);
+		// sRGB to XYZ, each row already divided by the D65 white point
+		float fx = labForward((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / 0.95047f);
+		float fy = labForward(0.2126729f * r + 0.7151522f * g + 0.0721750f * b);
+		float fz = labForward((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / 1.08883f);
+		c0[i] = 116.0f * fy - 16.0f;
+		c1[i] = 500.0f * (fx - fy);
+		c2[i] = 200.0f * (fy - fz);
+	}
+}
+
+void labToRgb(float* c0, float* c1, float* c2, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		float fy = (c0[i] + 16.0f) / 116.0f;
+		float x = labInverse(fy + c1[i] / 500.0f) * 0.95047f;
+		float y = labInverse(fy);
+		float z = labInverse(fy - c2[i] / 200.0f) * 1.08883f;
+		c0[i] = linearToSrgb(std::max(0.0f, 3.2404542f * x - 1.5371385f * y - 0.4985314f * z));
+		c1[i] = linearToSrgb(std::max(0.0f, -0.9692660f * x + 1.8760108f * y + 0.0415560f * z));
+		c2[i] = linearToSrgb(std::max(0.0f, 0.0556434f * x - 0.2040259f * y + 1.0572252f * z));
+	}
+}
+
+// Converts three channel spans between any two spaces, going through RGB
+void convertColorSpan(ColorSpace from, ColorSpace to, float* c0, float* c1, float* c2, size_t count)
+{
+	if (from == to) {
+		return;
+	}
+	switch (from)
+	{
+	case ColorSpace::HSV: hsvToRgb(c0, c1, c2, count); break;
+	case ColorSpace::HSL: hslToRgb(c0, c1, c2, count); break;
+	case ColorSpace::YCbCr: yCbCrToRgb(c0, c1, c2, count); break;
+	case ColorSpace::Lab: labToRgb(c0, c1, c2, count); break;
+	case ColorSpace::RGB: break;
+	}
+	switch (to)
+	{
+	case ColorSpace::HSV: rgbToHsv(c0, c1, c2, count); break;
+	case ColorSpace::HSL: rgbToHsl(c0, c1, c2, count); break;
+	case ColorSpace::YCbCr: rgbToYCbCr(c0, c1, c2, count); break;
+	case ColorSpace::Lab: rgbToLab(c0, c1, c2, count); break;
+	case ColorSpace::RGB: break;
+	}
+}
+
+void convertColorSpace(PlanarImage<float>& image, ColorSpace to)
+{
+	parallelRows(image.height, [&](int y0, int y1)
+	{
+		size_t count = static_cast<size_t>(y1 - y0) * image.width;
+		convertColorSpan(image.space, to, image.row(0, y0), image.row(1, y0), image.row(2, y0), count);
+	});
+	image.space = to;
+}
+
+// Scale and offset from a float channel to its 8-bit encoding (byte = value * scale + offset)
+struct ChannelEncoding
+{
+	float scale{};
+	float offset{};
+	bool wraps{};
+};
+
+constexpr std::array<ChannelEncoding, 3> channelEncodings(ColorSpace space)
+{
+	switch (space)
+	{
+	case ColorSpace::HSV:
+	case ColorSpace::HSL:
+		return { { { 256.0f / 360.0f, 0.0f, true }, { 255.0f, 0.0f }, { 255.0f, 0.0f } } };
+	case ColorSpace::YCbCr:
+		return { { { 255.0f, 0.0f }, { 255.0f, 128.0f }, { 255.0f, 128.0f } } };
+	case ColorSpace::Lab:
+		return { { { 255.0f / 100.0f, 0.0f }, { 1.0f, 128.0f }, { 1.0f, 128.0f } } };
+	default:
+		return { { { 255.0f, 0.0f }, { 255.0f, 0.0f }, { 255.0f, 0.0f } } };
+	}
+}
+
+void decodeChannels(const Pixel* source, ColorSpace space, float* c0, float* c1, float* c2, size_t count)
+{
+	std::array<ChannelEncoding, 3> encodings = channelEncodings(space);
+	std::array<float, 3> inverse{ 1.0f / encodings[0].scale, 1.0f / encodings[1].scale, 1.0f / encodings[2].scale };
+	for (size_t i = 0; i < count; ++i)
+	{
+		c0[i] = (source[i].r - encodings[0].offset) * inverse[0];
+		c1[i] = (source[i].g - encodings[1].offset) * inverse[1];
+		c2[i] = (source[i].b - encodings[2].offset) * inverse[2];
+	}
+}
+
+void encodeChannels(Pixel* target, ColorSpace space, const float* c0, const float* c1, const float* c2, size_t count)
+{
+	std::array<ChannelEncoding, 3> encodings = channelEncodings(space);
+	auto encode = [](float value, const ChannelEncoding& encoding)
+	{
+		int code = static_cast<int>(std::lround(value * encoding.scale + encoding.offset));
+		return static_cast<unsigned char>(encoding.wraps ? code & 0xFF : std::clamp(code, 0, 255));
+	};
+	for (size_t i = 0; i < count; ++i)
+	{
+		target[i].r = encode(c0[i], encodings[0]);
+		target[i].g = encode(c1[i], encodings[1]);
+		target[i].b = encode(c2[i], encodings[2]);
+	}
+}
+
+PlanarImage<float> ImageData::toPlanar(ColorSpace space) const
+{
+	PlanarImage<float> planar(width, height);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			const Pixel* source = pixels[y].data();
+			decodeChannels(source, ColorSpace::RGB, planar.row(0, y), planar.row(1, y), planar.row(2, y), width);
+			float* alpha = planar.row(3, y);
+			for (int x = 0; x < width; ++x) {
+				alpha[x] = source[x].a / 255.0f;
+			}
+		}
+		size_t count = static_cast<size_t>(y1 - y0) * width;
+		convertColorSpan(ColorSpace::RGB, space, planar.row(0, y0), planar.row(1, y0), planar.row(2, y0), count);
+	});
+	planar.space = space;
+	return planar;
+}
+
+void ImageData::fromPlanar(const PlanarImage<float>& planar)
+{
+	*this = ImageData(planar.width, planar.height);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		std::array<std::vector<float>, 3> scratch;
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int c = 0; c < 3; ++c) {
+				scratch[c].assign(planar.row(c, y), planar.row(c, y) + width);
+			}
+			convertColorSpan(planar.space, ColorSpace::RGB, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			Pixel* target = pixels[y].data();
+			encodeChannels(target, ColorSpace::RGB, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			const float* alpha = planar.row(3, y);
+			for (int x = 0; x < width; ++x) {
+				target[x].a = static_cast<unsigned char>(std::clamp(static_cast<int>(std::lround(alpha[x] * 255.0f)), 0, 255));
+			}
+		}
+	});
+}
+
+void ImageData::convertColorSpace(ColorSpace from, ColorSpace to)
+{
+	if (from == to) {
+		return;
+	}
+	parallelRows(height, [&](int y0, int y1)
+	{
+		std::array<std::vector<float>, 3> scratch;
+		for (auto& channel : scratch) {
+			channel.resize(width);
+		}
+		for (int y = y0; y < y1; ++y)
+		{
+			decodeChannels(pixels[y].data(), from, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			convertColorSpan(from, to, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			encodeChannels(pixels[y].data(), to, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+		}
+	});
+}
+
+template <typename Fn>
+void ImageData::transformInColorSpace(ColorSpace space, Fn fn)
+{
+	parallelRows(height, [&](int y0, int y1)
+	{
+		std::array<std::vector<float>, 3> scratch;
+		for (auto& channel : scratch) {
+			channel.resize(width);
+		}
+		for (int y = y0; y < y1; ++y)
+		{
+			decodeChannels(pixels[y].data(), ColorSpace::RGB, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			convertColorSpan(ColorSpace::RGB, space, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			fn(scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			convertColorSpan(space, ColorSpace::RGB, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+			encodeChannels(pixels[y].data(), ColorSpace::RGB, scratch[0].data(), scratch[1].data(), scratch[2].data(), width);
+		}
+	});
+}
+
+void ImageData::saturation(float factor)
+{
+	transformInColorSpace(ColorSpace::HSV, [factor](float*, float* s, float*, int count)
+	{
+		for (int i = 0; i < count; ++i) {
+			s[i] = std::min(s[i] * factor, 1.0f);
+		}
+	});
+}
+
+void ImageData::hueShift(float degrees)
+{
+	float offset = std::fmod(degrees, 360.0f) + 360.0f;
+	transformInColorSpace(ColorSpace::HSV, [offset](float* h, float*, float*, int count)
+	{
+		for (int i = 0; i < count; ++i) {
+			h[i] = std::fmod(h[i] + offset, 360.0f);
+		}
+	});
+}
+
+// Tone Mapping Functions
+// ------------------------------------------------------------------------------------
+
+constexpr float luminance709(float r, float g, float b)
+{
+	return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+// sRGB encoding of [0, 1] sampled at 4096 points; fine enough that the 8-bit result is off by at most one
+constexpr int srgbTableSize{ 4096 };
+
+const std::array<unsigned char, srgbTableSize>& srgbEncodeTable()
+{
+	static const std::array<unsigned char, srgbTableSize> table = []
+	{
+		std::array<unsigned char, srgbTableSize> values{};
+		for (int i = 0; i < srgbTableSize; ++i) {
+			values[i] = static_cast<unsigned char>(std::lround(linearToSrgb(static_cast<float>(i) / (srgbTableSize - 1)) * 255.0f));
+		}
+		return values;
+	}();
+	return table;
+}
+
+float logAverageLuminance(const PlanarImage<float>& image)
+{
+	// Keeps log() finite for black pixels
+	constexpr float delta = 1e-4f;
+	std::vector<double> bands(rowBandCount(image.height));
+	parallelBands(image.height, [&](int band, int y0, int y1)
+	{
+		const float* r = image.row(0, y0);
+		const float* g = image.row(1, y0);
+		const float* b = image.row(2, y0);
+		size_t count = static_cast<size_t>(y1 - y0) * image.width;
+		double sum = 0.0;
+		for (size_t i = 0; i < count; ++i) {
+			sum += std::log(delta + std::max(0.0f, luminance709(r[i], g[i], b[i])));
+		}
+		bands[band] = sum;
+	});
+	double total = 0.0;
+	for (double sum : bands) {
+		total += sum;
+	}
+	return static_cast<float>(std::exp(total / (static_cast<double>(image.width) * image.height)));
+}
+
+// Hable's Uncharted 2 curve before white-point normalisation
+constexpr float filmicCurve(float x)
+{
+	constexpr float a = 0.15f, b = 0.50f, c = 0.10f, d = 0.20f, e = 0.02f, f = 0.30f;
+	return (x * (a * x + c * b) + d * e) / (x * (a * x + b) + d * f) - e / f;
+}
+
+ImageData toneMap(const PlanarImage<float>& hdr, ToneMapOperator op, float key)
+{
+	if (hdr.space != ColorSpace::RGB) {
+		throw std::invalid_argument("Planes must hold RGB data");
+	}
+	float exposure = key > 0.0f ? key / logAverageLuminance(hdr) : 1.0f;
+	const std::array<unsigned char, srgbTableSize>& encode = srgbEncodeTable();
+	constexpr float filmicWhite = 11.2f;
+	const float filmicScale = 1.0f / filmicCurve(filmicWhite);
+
+	ImageData result(hdr.width, hdr.height);
+	parallelRows(hdr.height, [&](int y0, int y1)
+	{
+		std::array<std::vector<float>, 3> mapped;
+		for (auto& channel : mapped) {
+			channel.resize(hdr.width);
+		}
+		for (int y = y0; y < y1; ++y)
+		{
+			const float* r = hdr.row(0, y);
+			const float* g = hdr.row(1, y);
+			const float* b = hdr.row(2, y);
+			switch (op)
+			{
+			case ToneMapOperator::Reinhard:
+				// Global Reinhard on luminance; colour is scaled by the compressed / original ratio
+				for (int x = 0; x < hdr.width; ++x)
+				{
+					float lum = std::max(0.0f, luminance709(r[x], g[x], b[x])) * exposure;
+					float ratio = lum > 0.0f ? exposure / (1.0f + lum) : 0.0f;
+					mapped[0][x] = r[x] * ratio;
+					mapped[1][x] = g[x] * ratio;
+					mapped[2][x] = b[x] * ratio;
+				}
+				break;
+			case ToneMapOperator::ACES:
+				// Narkowicz's fit of the ACES reference rendering transform, per channel
+				for (int c = 0; c < 3; ++c)
+				{
+					const float* source = hdr.row(c, y);
+					for (int x = 0; x < hdr.width; ++x)
+					{
+						float v = std::max(0.0f, source[x] * exposure);
+						mapped[c][x] = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+					}
+				}
+				break;
+			case ToneMapOperator::Filmic:
+				for (int c = 0; c < 3; ++c)
+				{
+					const float* source = hdr.row(c, y);
+					for (int x = 0; x < hdr.width; ++x) {
+						mapped[c][x] = filmicCurve(std::max(0.0f, source[x] * exposure * 2.0f)) * filmicScale;
+					}
+				}
+				break;
+			}
+
+			const float* alpha = hdr.row(3, y);
+			for (int x = 0; x < hdr.width; ++x)
+			{
+				auto code = [&](float v) { return encode[static_cast<int>(std::clamp(v, 0.0f, 1.0f) * (srgbTableSize - 1) + 0.5f)]; };
+				result.setPixel(y, x, {
+					code(mapped[0][x]),
+					code(mapped[1][x]),
+					code(mapped[2][x]),
+					static_cast<unsigned char>(std::clamp(alpha[x], 0.0f, 1.0f) * 255.0f + 0.5f)
+				});
+			}
+		}
+	});
+	return result;
+}
+
+// Quantization Functions
+// ------------------------------------------------------------------------------------
+
+// Palettes are built over all four RGBA channels so quantize output always fits IndexedPNG
+constexpr int paletteChannels{ 4 };
+using PaletteColor = std::array<float, paletteChannels>;
+
+// One 5:5:5:3 RGBA histogram cell with the exact sums of the samples that fell into it
+struct ColorBin
+{
+	std::uint32_t count{};
+	std::array<std::uint64_t, paletteChannels> sum{};
+
+	PaletteColor mean() const
+	{
+		PaletteColor result{};
+		for (int c = 0; c < paletteChannels; ++c) {
+			result[c] = static_cast<float>(sum[c]) / count;
+		}
+		return result;
+	}
+};
+
+constexpr int colorGridBits{ 5 };
+constexpr int colorGridSize{ 1 << colorGridBits };
+constexpr int alphaGridBits{ 3 };
+constexpr int colorGridCells{ colorGridSize * colorGridSize * colorGridSize << alphaGridBits };
+
+constexpr int colorGridIndex(const Pixel& pixel)
+{
+	constexpr int shift = 8 - colorGridBits;
+	return (((((pixel.r >> shift) << colorGridBits) | (pixel.g >> shift)) << colorGridBits | (pixel.b >> shift)) << alphaGridBits)
+		| (pixel.a >> (8 - alphaGridBits));
+}
+
+// Centre of a grid cell, used for cells that no sample fell into
+constexpr PaletteColor colorGridCentre(int cell)
+{
+	constexpr int shift = 8 - colorGridBits;
+	constexpr int alphaShift = 8 - alphaGridBits;
+	constexpr float half = (1 << shift) / 2.0f;
+	int rgb = cell >> alphaGridBits;
+	return {
+		static_cast<float>((rgb >> (2 * colorGridBits)) << shift) + half,
+		static_cast<float>(((rgb >> colorGridBits) & (colorGridSize - 1)) << shift) + half,
+		static_cast<float>((rgb & (colorGridSize - 1)) << shift) + half,
+		static_cast<float>((cell & ((1 << alphaGridBits) - 1)) << alphaShift) + (1 << alphaShift) / 2.0f
+	};
+}
+
+// Median cut over the occupied bins: repeatedly split the box with the widest weighted
+// channel range at the median sample of that channel
+std::vector<PaletteColor> medianCutPalette(const std::vector<ColorBin>& bins, const std::vector<int>& occupied, int maxColors)
+{
+	struct Box
+	{
+		std::vector<int> cells{};
+		std::uint64_t count{};
+		int channel{};
+		float score{};
+	};
+	auto measure = [&](Box& box)
+	{
+		PaletteColor low{ 255.0f, 255.0f, 255.0f, 255.0f };
+		PaletteColor high{};
+		box.count = 0;
+		for (int cell : box.cells)
+		{
+			PaletteColor m = bins[cell].mean();
+			for (int c = 0; c < paletteChannels; ++c)
+			{
+				low[c] = std::min(low[c], m[c]);
+				high[c] = std::max(high[c], m[c]);
+			}
+			box.count += bins[cell].count;
+		}
+		box.channel = 0;
+		for (int c = 1; c < paletteChannels; ++c)
+		{
+			if (high[c] - low[c] > high[box.channel] - low[box.channel]) {
+				box.channel = c;
+			}
+		}
+		float range = high[box.channel] - low[box.channel];
+		box.score = box.cells.size() < 2 ? -1.0f : range * std::sqrt(static_cast<float>(box.count));
+	};
+
+	std::vector<Box> boxes(1);
+	boxes[0].cells = occupied;
+	measure(boxes[0]);
+	while (static_cast<int>(boxes.size()) < maxColors)
+	{
+		auto widest = std::max_element(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) { return a.score < b.score; });
+		if (widest->score <= 0.0f) {
+			break;
+		}
+		int channel = widest->channel;
+		std::vector<int>& cells = widest->cells;
+		std::sort(cells.begin(), cells.end(), [&](int a, int b) { return bins[a].mean()[channel] < bins[b].mean()[channel]; });
+
+		std::uint64_t half = widest->count / 2;
+		std::uint64_t running = 0;
+		size_t split = 1;
+		for (; split < cells.size() - 1; ++split)
+		{
+			running += bins[cells[split - 1]].count;
+			if (running >= half) {
+				break;
+			}
+		}
+		Box upper;
+		upper.cells.assign(cells.begin() + static_cast<std::ptrdiff_t>(split), cells.end());
+		cells.resize(split);
+		measure(*widest);
+		measure(upper);
+		boxes.push_back(std::move(upper));
+	}
+
+	std::vector<PaletteColor> palette;
+	for (const Box& box : boxes)
+	{
+		std::array<double, paletteChannels> sum{};
+		for (int cell : box.cells)
+		{
+			for (int c = 0; c < paletteChannels; ++c) {
+				sum[c] += static_cast<double>(bins[cell].sum[c]);
+			}
+		}
+		PaletteColor color{};
+		for (int c = 0; c < paletteChannels; ++c) {
+			color[c] = static_cast<float>(sum[c] / box.count);
+		}
+		palette.push_back(color);
+	}
+	return palette;
+}
+
+int nearestColor(const std::vector<PaletteColor>& palette, const PaletteColor& color)
+{
+	int best = 0;
+	float bestDistance = 1e30f;
+	for (size_t i = 0; i < palette.size(); ++i)
+	{
+		float distance = 0.0f;
+		for (int c = 0; c < paletteChannels; ++c)
+		{
+			float d = palette[i][c] - color[c];
+			distance += d * d;
+		}
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			best = static_cast<int>(i);
+		}
+	}
+	return best;
+}
+
+// Weighted Lloyd iterations over the histogram bins (not the pixels), seeded by median cut
+void refineKMeans(std::vector<PaletteColor>& palette, const std::vector<ColorBin>& bins, const std::vector<int>& occupied, int iterations)
+{
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		std::vector<std::array<double, paletteChannels + 1>> totals(palette.size());
+		for (int cell : occupied)
+		{
+			int nearest = nearestColor(palette, bins[cell].mean());
+			for (int c = 0; c < paletteChannels; ++c) {
+				totals[nearest][c] += static_cast<double>(bins[cell].sum[c]);
+			}
+			totals[nearest][paletteChannels] += bins[cell].count;
+		}
+		bool moved = false;
+		for (size_t i = 0; i < palette.size(); ++i)
+		{
+			if (totals[i][paletteChannels] == 0.0) {
+				continue;
+			}
+			for (int c = 0; c < paletteChannels; ++c)
+			{
+				float updated = static_cast<float>(totals[i][c] / totals[i][paletteChannels]);
+				moved = moved || std::abs(updated - palette[i][c]) > 0.5f;
+				palette[i][c] = updated;
+			}
+		}
+		if (!moved) {
+			break;
+		}
+	}
+}
+
+std::vector<Pixel> ImageData::quantize(int maxColors, QuantizeMethod method)
+{
+	if (maxColors < 2 || maxColors > 256) {
+		throw std::invalid_argument("Palette size must be between 2 and 256");
+	}
+
+	// Sample on a regular grid so the histogram pass stays around a quarter-million pixels
+	constexpr std::int64_t targetSamples{ 1 << 18 };
+	std::int64_t total = static_cast<std::int64_t>(width) * height;
+	int step = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(total) / targetSamples)));
+	std::vector<ColorBin> bins(colorGridCells);
+	for (int y = 0; y < height; y += step)
+	{
+		for (int x = 0; x < width; x += step)
+		{
+			const Pixel& pixel = pixels[y][x];
+			ColorBin& bin = bins[colorGridIndex(pixel)];
+			++bin.count;
+			bin.sum[0] += pixel.r;
+			bin.sum[1] += pixel.g;
+			bin.sum[2] += pixel.b;
+			bin.sum[3] += pixel.a;
+		}
+	}
+	std::vector<int> occupied;
+	for (int i = 0; i < colorGridCells; ++i)
+	{
+		if (bins[i].count != 0) {
+			occupied.push_back(i);
+		}
+	}
+	if (occupied.empty()) {
+		return {};
+	}
+
+	std::vector<PaletteColor> centers = medianCutPalette(bins, occupied, maxColors);
+	if (method == QuantizeMethod::KMeans) {
+		refineKMeans(centers, bins, occupied, 16);
+	}
+
+	std::vector<Pixel> palette;
+	for (const auto& center : centers)
+	{
+		palette.push_back({
+			static_cast<unsigned char>(std::lround(center[0])),
+			static_cast<unsigned char>(std::lround(center[1])),
+			static_cast<unsigned char>(std::lround(center[2])),
+			static_cast<unsigned char>(std::lround(center[3]))
+		});
+	}
+
+	// Nearest palette entry for every grid cell a pixel falls into, using the cell's sampled mean
+	// when it has one. Only marked cells are searched, which keeps opaque images to one alpha slice.
+	std::vector<unsigned char> used(colorGridCells);
+	for (const std::vector<Pixel>& row : pixels)
+	{
+		for (const Pixel& pixel : row) {
+			used[colorGridIndex(pixel)] = 1;
+		}
+	}
+	std::vector<unsigned char> grid(colorGridCells);
+	constexpr int sliceCells = colorGridCells / colorGridSize;
+	parallelRows(colorGridSize, [&](int r0, int r1)
+	{
+		for (int cell = r0 * sliceCells; cell < r1 * sliceCells; ++cell)
+		{
+			if (used[cell]) {
+				grid[cell] = static_cast<unsigned char>(nearestColor(centers, bins[cell].count != 0 ? bins[cell].mean() : colorGridCentre(cell)));
+			}
+		}
+	});
+
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			for (Pixel& pixel : pixels[y]) {
+				pixel = palette[grid[colorGridIndex(pixel)]];
+			}
+		}
+	});
+	return palette;
+}
+
+// Histogram Functions
+// ------------------------------------------------------------------------------------
+// Each row band counts into its own private bins, merged once at the end. Within a band,
+// consecutive pixels alternate between four sub-histograms so repeated values do not
+// serialise on a store-to-load dependency through the same counter.
+
+constexpr int histogramLanes{ 4 };
+
+unsigned char channelValue(const Pixel& pixel, HistogramChannel channel)
+{
+	switch (channel)
+	{
+	case HistogramChannel::R:
+		return pixel.r;
+	case HistogramChannel::G:
+		return pixel.g;
+	case HistogramChannel::B:
+		return pixel.b;
+	case HistogramChannel::A:
+		return pixel.a;
+	default:
+		return luma(pixel);
+	}
+}
+
+ImageHistogram ImageData::histogram() const
+{
+	using Lanes = std::array<std::array<Histogram, 5>, histogramLanes>;
+	std::vector<Lanes> bands(rowBandCount(height));
+
+	parallelBands(height, [&](int band, int y0, int y1)
+	{
+		Lanes& lanes = bands[band];
+		for (int y = y0; y < y1; ++y)
+		{
+			const Pixel* row = pixels[y].data();
+			int x = 0;
+			for (; x + histogramLanes <= width; x += histogramLanes)
+			{
+				for (int lane = 0; lane < histogramLanes; ++lane)
+				{
+					const Pixel& pixel = row[x + lane];
+					++lanes[lane][0][pixel.r];
+					++lanes[lane][1][pixel.g];
+					++lanes[lane][2][pixel.b];
+					++lanes[lane][3][pixel.a];
+					++lanes[lane][4][luma(pixel)];
+				}
+			}
+			for (; x < width; ++x)
+			{
+				const Pixel& pixel = row[x];
+				++lanes[0][0][pixel.r];
+				++lanes[0][1][pixel.g];
+				++lanes[0][2][pixel.b];
+				++lanes[0][3][pixel.a];
+				++lanes[0][4][luma(pixel)];
+			}
+		}
+	});
+
+	ImageHistogram result;
+	for (const Lanes& lanes : bands)
+	{
+		for (const auto& lane : lanes)
+		{
+			for (int c = 0; c < 5; ++c)
+			{
+				for (int i = 0; i < 256; ++i)
+				{
+					result.channels[c][i] += lane[c][i];
+				}
+			}
+		}
+	}
+	return result;
+}
+
+Histogram ImageData::histogram(HistogramChannel channel) const
+{
+	using Lanes = std::array<Histogram, histogramLanes>;
+	std::vector<Lanes> bands(rowBandCount(height));
+
+	auto count = [&](auto value)
+	{
+		parallelBands(height, [&](int band, int y0, int y1)
+		{
+			Lanes& lanes = bands[band];
+			for (int y = y0; y < y1; ++y)
+			{
+				const Pixel* row = pixels[y].data();
+				int x = 0;
+				for (; x + histogramLanes <= width; x += histogramLanes)
+				{
+					++lanes[0][value(row[x])];
+					++lanes[1][value(row[x + 1])];
+					++lanes[2][value(row[x + 2])];
+					++lanes[3][value(row[x + 3])];
+				}
+				for (; x < width; ++x)
+				{
+					++lanes[0][value(row[x])];
+				}
+			}
+		});
+	};
+
+	switch (channel)
+	{
+	case HistogramChannel::R:
+		count([](const Pixel& p) { return p.r; });
+		break;
+	case HistogramChannel::G:
+		count([](const Pixel& p) { return p.g; });
+		break;
+	case HistogramChannel::B:
+		count([](const Pixel& p) { return p.b; });
+		break;
+	case HistogramChannel::A:
+		count([](const Pixel& p) { return p.a; });
+		break;
+	case HistogramChannel::Luma:
+		count([](const Pixel& p) { return luma(p); });
+		break;
+	}
+
+	Histogram result{};
+	for (const Lanes& lanes : bands)
+	{
+		for (const Histogram& lane : lanes)
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				result[i] += lane[i];
+			}
+		}
+	}
+	return result;
+}
+
+std::vector<std::uint32_t> ImageData::histogram2D(HistogramChannel first, HistogramChannel second) const
+{
+	// 256 KiB per band is already too large for sub-histogram lanes to pay off
+	std::vector<std::vector<std::uint32_t>> bands(rowBandCount(height), std::vector<std::uint32_t>(256 * 256));
+	parallelBands(height, [&](int band, int y0, int y1)
+	{
+		std::vector<std::uint32_t>& bins = bands[band];
+		for (int y = y0; y < y1; ++y)
+		{
+			for (const Pixel& pixel : pixels[y])
+			{
+				++bins[channelValue(pixel, first) * 256 + channelValue(pixel, second)];
+			}
+		}
+	});
+
+	std::vector<std::uint32_t> result(256 * 256);
+	for (const auto& bins : bands)
+	{
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			result[i] += bins[i];
+		}
+	}
+	return result;
+}
+
+// Equalisation Functions
+// ------------------------------------------------------------------------------------
+
+void ImageData::applyLookupTable(const LookupTable& lut)
+{
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			for (Pixel& pixel : pixels[y])
+			{
+				pixel.r = lut[pixel.r];
+				pixel.g = lut[pixel.g];
+				pixel.b = lut[pixel.b];
+			}
+		}
+	});
+}
+
+// Cumulative mapping of a histogram onto [0, 255]
+ImageData::LookupTable equalizationTable(const Histogram& histogram, bool stretchFromFirstBin)
+{
+	std::uint64_t total = 0;
+	for (std::uint32_t count : histogram) {
+		total += count;
+	}
+	std::uint64_t cdfMin = 0;
+	if (stretchFromFirstBin)
+	{
+		for (std::uint32_t count : histogram)
+		{
+			if (count != 0)
+			{
+				cdfMin = count;
+				break;
+			}
+		}
+	}
+
+	ImageData::LookupTable lut{};
+	std::uint64_t range = total - cdfMin;
+	std::uint64_t cdf = 0;
+	for (int i = 0; i < 256; ++i)
+	{
+		cdf += histogram[i];
+		lut[i] = range == 0
+			? static_cast<unsigned char>(i)
+			: static_cast<unsigned char>(((cdf > cdfMin ? cdf - cdfMin : 0) * 255 + range / 2) / range);
+	}
+	return lut;
+}
+
+// Scales R, G and B so the pixel's luma becomes target; black pixels turn grey
+constexpr void rescaleLuma(Pixel& pixel, int target)
+{
+	int current = luma(pixel);
+	if (current == 0)
+	{
+		pixel.r = pixel.g = pixel.b = static_cast<unsigned char>(target);
+		return;
+	}
+	auto scale = [&](unsigned char v)
+	{
+		return static_cast<unsigned char>(std::min(255, (v * target + current / 2) / current));
+	};
+	pixel.r = scale(pixel.r);
+	pixel.g = scale(pixel.g);
+	pixel.b = scale(pixel.b);
+}
+
+void ImageData::equalizeHistogram()
+{
+	LookupTable lut = equalizationTable(histogram(HistogramChannel::Luma), true);
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			for (Pixel& pixel : pixels[y])
+			{
+				rescaleLuma(pixel, lut[luma(pixel)]);
+			}
+		}
+	});
+}
+
+void ImageData::clahe(int tilesX, int tilesY, float clipLimit)
+{
+	if (tilesX <= 0 || tilesY <= 0) {
+		throw std::invalid_argument("Invalid input");
+	}
+	tilesX = std::min(tilesX, width);
+	tilesY = std::min(tilesY, height);
+	// Tile i spans [size * i / tiles, size * (i + 1) / tiles), so every tile is non-empty
+	auto tileStart = [](int size, int tiles, int i)
+	{
+		return static_cast<int>(static_cast<std::int64_t>(size) * i / tiles);
+	};
+	int tileCount = tilesX * tilesY;
+
+	// Per-tile clipped luma histograms turned into equalisation tables
+	std::vector<LookupTable> luts(tileCount);
+	std::atomic<int> nextTile{ 0 };
+	parallelFor(std::min(workerCount(), tileCount), [&](int)
+	{
+		for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+		{
+			int tx = tile % tilesX;
+			int ty = tile / tilesX;
+			int x0 = tileStart(width, tilesX, tx);
+			int y0 = tileStart(height, tilesY, ty);
+			Rect area{ x0, y0, tileStart(width, tilesX, tx + 1) - x0, tileStart(height, tilesY, ty + 1) - y0 };
+			Histogram bins{};
+			for (int y = area.y; y < area.y + area.height; ++y)
+			{
+				for (int x = area.x; x < area.x + area.width; ++x)
+				{
+					++bins[luma(pixels[y][x])];
+				}
+			}
+
+			if (clipLimit > 0.0f)
+			{
+				std::uint32_t limit = std::max<std::uint32_t>(1, static_cast<std::uint32_t>(clipLimit * area.width * area.height / 256.0f));
+				std::uint32_t excess = 0;
+				for (std::uint32_t& count : bins)
+				{
+					if (count > limit)
+					{
+						excess += count - limit;
+						count = limit;
+					}
+				}
+				std::uint32_t share = excess / 256;
+				std::uint32_t remainder = excess % 256;
+				for (int i = 0; i < 256; ++i)
+				{
+					bins[i] += share + (static_cast<std::uint32_t>(i) < remainder ? 1 : 0);
+				}
+			}
+			luts[tile] = equalizationTable(bins, false);
+		}
+	});
+
+	// Each pixel blends the tables of the four nearest tile centres, with 8-bit weights
+	struct Neighbours
+	{
+		int first{};
+		int second{};
+		int weight{};
+	};
+	auto neighbours = [&](int size, int tiles)
+	{
+		std::vector<float> centres(tiles);
+		for (int i = 0; i < tiles; ++i)
+		{
+			centres[i] = 0.5f * (tileStart(size, tiles, i) + tileStart(size, tiles, i + 1));
+		}
+		std::vector<Neighbours> result(size);
+		int first = 0;
+		for (int i = 0; i < size; ++i)
+		{
+			float position = i + 0.5f;
+			while (first + 1 < tiles && centres[first + 1] <= position) {
+				++first;
+			}
+			int second = std::min(first + 1, tiles - 1);
+			float t = second == first ? 0.0f : std::clamp((position - centres[first]) / (centres[second] - centres[first]), 0.0f, 1.0f);
+			result[i] = { first, second, static_cast<int>(t * 256.0f + 0.5f) };
+		}
+		return result;
+	};
+	std::vector<Neighbours> columns = neighbours(width, tilesX);
+	std::vector<Neighbours> rows = neighbours(height, tilesY);
+
+	parallelRows(height, [&](int y0, int y1)
+	{
+		for (int y = y0; y < y1; ++y)
+		{
+			const Neighbours& row = rows[y];
+			for (int x = 0; x < width; ++x)
+			{
+				const Neighbours& column = columns[x];
+				const LookupTable& lut00 = luts[row.first * tilesX + column.first];
+				const LookupTable& lut01 = luts[row.first * tilesX + column.second];
+				const LookupTable& lut10 = luts[row.second * tilesX + column.first];
+				const LookupTable& lut11 = luts[row.second * tilesX + column.second];
+				Pixel& pixel = pixels[y][x];
+				unsigned char v = luma(pixel);
+				int top = lut00[v] * (256 - column.weight) + lut01[v] * column.weight;
+				int bottom = lut10[v] * (256 - column.weight) + lut11[v] * column.weight;
+				rescaleLuma(pixel, (top * (256 - row.weight) + bottom * row.weight + (1 << 15)) >> 16);
+			}
+		}
+	});
+}
+
+// Geomoetry Functions
+// ------------------------------------------------------------------------------------
+
+void ImageData::flipH()
+{
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width / 2; ++x)
+		{
+			std::swap(pixels[y][x], pixels[y][width - x - 1]);
+		}
+	}
+}
+
+void ImageData::flipV()
+{
+	for (int y = 0; y < height / 2; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			std::swap(pixels[y][x], pixels[height - y - 1][x]);
+		}
+	}
+}
+
+void ImageData::rotateR()
+{
+	Vector2D<Pixel> rotatedPixels(width, std::vector<Pixel>(height));
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			rotatedPixels[x][height - y - 1] = pixels[y][x];
+		}
+	}
+	pixels = std::move(rotatedPixels);
+	std::swap(width, height);
+}
+
+void ImageData::rotateL()
+{
+	Vector2D<Pixel> rotatedPixels(width, std::vector<Pixel>(height));
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			rotatedPixels[width - x - 1][y] = pixels[y][x];
+		}
+	}
+	pixels = std::move(rotatedPixels);
+	std::swap(width, height);
+}
+
+constexpr int maxSize{ 4096 };
+void ImageData::resize(int w, int h)
+{
+	if (w <= 0 || w > maxSize || h <= 0 || h > maxSize) {
+		throw std::invalid_argument("Invalid input");
+	}
+	Vector2D<Pixel> resizedPixels(h, std::vector<Pixel>(w));
+	float xRatio = static_cast<float>(width) / w;
+	float yRatio = static_cast<float>(height) / h;
+	for (int y = 0; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+		{
+			int srcX = static_cast<int>(x * xRatio);
+			int srcY = static_cast<int>(y * yRatio);
+			resizedPixels[y][x] = pixels[srcY][srcX];
+		}
+	}
+	pixels = std::move(resizedPixels);
+	width = w;
+	height = h;
+}
+
+void ImageData::crop(int x, int y, int w, int h)
+{
+	if (x < 0 || x > width) {
+		throw std::invalid_argument("Invalid input");
+	}
+	if (y < 0 || y > height) {
+		throw std::invalid_argument("Invalid input");
+	}
+	if (x + w > width) {
+		w = width - x;
+	}
+	if (y + h > height) {
+		h = height - y;
+	}
+	Vector2D<Pixel> croppedPixels(h, std::vector<Pixel>(w));
+	for (int i = 0; i < h; ++i)
+	{
+		for (int j = 0; j < w; ++j)
+		{
+			croppedPixels[i][j] = pixels[y + i][x + j];
+		}
+	}
+	pixels = std::move(croppedPixels);
+	width = w;
+	height = h;
+}
+
+// Each level halves the previous one (rounding down, never below 1x1) and is filtered from it directly,
+// so building N levels reads every source pixel once instead of once per level
+ImagePyramid ImageData::buildPyramid(int levels, PyramidFilter filter) const
+{
+	if (levels <= 0 || width <= 0 || height <= 0) {
+		throw std::invalid_argument("Invalid input");
+	}
+
+	ImagePyramid pyramid;
+	size_t total = 0;
+	for (int w = width, h = height, i = 0; i < levels; ++i)
+	{
+		pyramid.levels.push_back({ w, h, total });
+		total += static_cast<size_t>(w) * h;
+		if (w == 1 && h == 1) {
+			break;
+		}
+		w = std::max(1, w / 2);
+		h = std::max(1, h / 2);
+	}
+	pyramid.pixels.resize(total);
+
+	Pixel* base = pyramid.pixels.data();
+	for (int y = 0; y < height; ++y)
+	{
+		std::copy(pixels[y].begin(), pixels[y].end(), base + static_cast<size_t>(y) * width);
+	}
+
+	// Gaussian uses the 5-tap binomial [1 4 6 4 1] / 16 per axis; box averages each 2x2 block
+	constexpr std::array<int, 5> taps{ 1, 4, 6, 4, 1 };
+	std::vector<std::array<int, pixelChannels>> column;
+
+	for (size_t i = 1; i < pyramid.levels.size(); ++i)
+	{
+		const ImagePyramid::Level& srcLevel = pyramid.levels[i - 1];
+		const ImagePyramid::Level& dstLevel = pyramid.levels[i];
+		const Pixel* src = pyramid.pixels.data() + srcLevel.offset;
+		Pixel* dst = pyramid.pixels.data() + dstLevel.offset;
+		int sw = srcLevel.width;
+		int sh = srcLevel.height;
+		column.assign(sw, {});
+
+		for (int y = 0; y < dstLevel.height; ++y)
+		{
+			// Vertical pass over the whole source row span, then horizontal decimation
+			for (auto& sum : column) {
+				sum = {};
+			}
+			if (filter == PyramidFilter::Gaussian)
+			{
+				for (int t = 0; t < 5; ++t)
+				{
+					const Pixel* row = src + static_cast<size_t>(std::clamp(2 * y + t - 2, 0, sh - 1)) * sw;
+					for (int x = 0; x < sw; ++x)
+					{
+						column[x][0] += taps[t] * row[x].r;
+						column[x][1] += taps[t] * row[x].g;
+						column[x][2] += taps[t] * row[x].b;
+						column[x][3] += taps[t] * row[x].a;
+					}
+				}
+			}
+			else
+			{
+				for (int t = 0; t < 2; ++t)
+				{
+					const Pixel* row = src + static_cast<size_t>(std::min(2 * y + t, sh - 1)) * sw;
+					for (int x = 0; x < sw; ++x)
+					{
+						column[x][0] += row[x].r;
+						column[x][1] += row[x].g;
+						column[x][2] += row[x].b;
+						column[x][3] += row[x].a;
+					}
+				}
+			}
+
+			Pixel* out = dst + static_cast<size_t>(y) * dstLevel.width;
+			for (int x = 0; x < dstLevel.width; ++x)
+			{
+				std::array<int, pixelChannels> sum{};
+				int shift = 0;
+				if (filter == PyramidFilter::Gaussian)
+				{
+					for (int t = 0; t < 5; ++t)
+					{
+						const auto& c = column[std::clamp(2 * x + t - 2, 0, sw - 1)];
+						for (int ch = 0; ch < pixelChannels; ++ch) {
+							sum[ch] += taps[t] * c[ch];
+						}
+					}
+					shift = 8;
+				}
+				else
+				{
+					for (int t = 0; t < 2; ++t)
+					{
+						const auto& c = column[std::min(2 * x + t, sw - 1)];
+						for (int ch = 0; ch < pixelChannels; ++ch) {
+							sum[ch] += c[ch];
+						}
+					}
+					shift = 2;
+				}
+				int round = 1 << (shift - 1);
+				out[x] = {
+					static_cast<unsigned char>((sum[0] + round) >> shift),
+					static_cast<unsigned char>((sum[1] + round) >> shift),
+					static_cast<unsigned char>((sum[2] + round) >> shift),
+					static_cast<unsigned char>((sum[3] + round) >> shift)
+				};
+			}
+		}
+	}
+	return pyramid;
+}
+
+ImageData ImagePyramid::level(int level) const
+{
+	if (level < 0 || level >= levelCount()) {
+		throw std::out_of_range("Pyramid level out of range");
+	}
+	const Level& info = levels[level];
+	ImageData image(info.width, info.height);
+	const Pixel* src = levelData(level);
+	for (int y = 0; y < info.height; ++y)
+	{
+		std::copy(src + static_cast<size_t>(y) * info.width, src + static_cast<size_t>(y + 1) * info.width, &image.getPixel(y, 0));
+	}
+	return image;
+}
+
+// Warp sampling: taps that fall outside the source image read the border colour
+// ------------------------------------------------------------------------------------
+
+Homography invertHomography(const Homography& m)
+{
+	float c0 = m[4] * m[8] - m[5] * m[7];
+	float c1 = m[5] * m[6] - m[3] * m[8];
+	float c2 = m[3] * m[7] - m[4] * m[6];
+	float det = m[0] * c0 + m[1] * c1 + m[2] * c2;
+	if (std::abs(det) < 1e-12f) {
+		throw std::invalid_argument("Transform is not invertible");
+	}
+	float inv = 1.0f / det;
+	return { {
+		c0 * inv, (m[2] * m[7] - m[1] * m[8]) * inv, (m[1] * m[5] - m[2] * m[4]) * inv,
+		c1 * inv, (m[0] * m[8] - m[2] * m[6]) * inv, (m[2] * m[3] - m[0] * m[5]) * inv,
+		c2 * inv, (m[1] * m[6] - m[0] * m[7]) * inv, (m[0] * m[4] - m[1] * m[3]) * inv
+	} };
+}
+
+const Pixel& fetchPixel(const Vector2D<Pixel>& src, int w, int h, int x, int y, const Pixel& border)
+{
+	return (x >= 0 && x < w && y >= 0 && y < h) ? src[y][x] : border;
+}
+
+Pixel sampleNearest(const Vector2D<Pixel>& src, int w, int h, float sx, float sy, const Pixel& border)
+{
+	return fetchPixel(src, w, h, static_cast<int>(std::floor(sx + 0.5f)), static_cast<int>(std::floor(sy + 0.5f)), border);
+}
+
+Pixel sampleBilinear(const Vector2D<Pixel>& src, int w, int h, float sx, float sy, const Pixel& border)
+{
+	float fx = std::floor(sx);
+	float fy = std::floor(sy);
+	int x0 = static_cast<int>(fx);
+	int y0 = static_cast<int>(fy);
+	if (x0 < -1 || x0 >= w || y0 < -1 || y0 >= h) {
+		return border;
+	}
+
+	// 8-bit fixed point weights keep the blend in integer arithmetic
+	int wx = static_cast<int>((sx - fx) * 256.0f + 0.5f);
+	int wy = static_cast<int>((sy - fy) * 256.0f + 0.5f);
+	const Pixel* p00;
+	const Pixel* p01;
+	const Pixel* p10;
+	const Pixel* p11;
+	if (x0 >= 0 && x0 + 1 < w && y0 >= 0 && y0 + 1 < h)
+	{
+		p00 = &src[y0][x0];
+		p01 = p00 + 1;
+		p10 = &src[y0 + 1][x0];
+		p11 = p10 + 1;
+	}
+	else
+	{
+		p00 = &fetchPixel(src, w, h, x0, y0, border);
+		p01 = &fetchPixel(src, w, h, x0 + 1, y0, border);
+		p10 = &fetchPixel(src, w, h, x0, y0 + 1, border);
+		p11 = &fetchPixel(src, w, h, x0 + 1, y0 + 1, border);
+	}
+
+	auto lerp2 = [wx, wy](int c00, int c01, int c10, int c11)
+	{
+		int top = c00 * 256 + (c01 - c00) * wx;
+		int bottom = c10 * 256 + (c11 - c10) * wx;
+		return static_cast<unsigned char>((top * 256 + (bottom - top) * wy + (1 << 15)) >> 16);
+	};
+	return {
+		lerp2(p00->r, p01->r, p10->r, p11->r),
+		lerp2(p00->g, p01->g, p10->g, p11->g),
+		lerp2(p00->b, p01->b, p10->b, p11->b),
+		lerp2(p00->a, p01->a, p10->a, p11->a)
+	};
+}
+
+// Catmull-Rom weights (a = -0.5) for the four taps around a fractional offset t
+std::array<float, 4> cubicWeights(float t)
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return { {
+		-0.5f * t3 + t2 - 0.5f * t,
+		1.5f * t3 - 2.5f * t2 + 1.0f,
+		-1.5f * t3 + 2.0f * t2 + 0.5f * t,
+		0.5f * t3 - 0.5f * t2
+	} };
+}
+
+Pixel sampleBicubic(const Vector2D<Pixel>& src, int w, int h, float sx, float sy, const Pixel& border)
+{
+	float fx = std::floor(sx);
+	float fy = std::floor(sy);
+	int x0 = static_cast<int>(fx);
+	int y0 = static_cast<int>(fy);
+	if (x0 < -2 || x0 > w || y0 < -2 || y0 > h) {
+		return border;
+	}
+
+	std::array<float, 4> wx = cubicWeights(sx - fx);
+	std::array<float, 4> wy = cubicWeights(sy - fy);
+	float r = 0.0f, g = 0.0f, b = 0.0f, a = 0.0f;
+	for (int i = 0; i < 4; ++i)
+	{
+		float rr = 0.0f, rg = 0.0f, rb = 0.0f, ra = 0.0f;
+		for (int j = 0; j < 4; ++j)
+		{
+			const Pixel& p = fetchPixel(src, w, h, x0 + j - 1, y0 + i - 1, border);
+			rr += wx[j] * p.r;
+			rg += wx[j] * p.g;
+			rb += wx[j] * p.b;
+			ra += wx[j] * p.a;
+		}
+		r += wy[i] * rr;
+		g += wy[i] * rg;
+		b += wy[i] * rb;
+		a += wy[i] * ra;
+	}
+	return {
+		static_cast<unsigned char>(std::clamp(r + 0.5f, 0.0f, 255.0f)),
+		static_cast<unsigned char>(std::clamp(g + 0.5f, 0.0f, 255.0f)),
+		static_cast<unsigned char>(std::clamp(b + 0.5f, 0.0f, 255.0f)),
+		static_cast<unsigned char>(std::clamp(a + 0.5f, 0.0f, 255.0f))
+	};
+}
+
+void ImageData::warpAffine(const AffineMatrix& matrix, Interpolation interpolation, const Pixel& border)
+{
+	Homography inverse = invertHomography({ {
+		matrix[0], matrix[1], matrix[2],
+		matrix[3], matrix[4], matrix[5],
+		0.0f, 0.0f, 1.0f
+	} });
+	warp<false>(inverse, interpolation, border);
+}
+
+void ImageData::warpPerspective(const Homography& homography, Interpolation interpolation, const Pixel& border)
+{
+	warp<true>(invertHomography(homography), interpolation, border);
+}
+
+// Source coordinates are stepped incrementally along each row, so the inner loop costs
+// three adds (plus one reciprocal for perspective) instead of a full matrix multiply. The
+// running sums are doubles: float steps drift by over a pixel across a 16000-pixel row.
+template <bool Projective>
+void ImageData::warp(const Homography& inverse, Interpolation interpolation, const Pixel& border)
+{
+	Vector2D<Pixel> warpedPixels(height, std::vector<Pixel>(width));
+	const double stepX = inverse[0];
+	const double stepY = inverse[3];
+	const double stepW = inverse[6];
+
+	auto run = [&](auto sample)
+	{
+		parallelRows(height, [&](int y0, int y1)
+		{
+			for (int y = y0; y < y1; ++y)
+			{
+				double sx = static_cast<double>(inverse[1]) * y + inverse[2];
+				double sy = static_cast<double>(inverse[4]) * y + inverse[5];
+				double sw = static_cast<double>(inverse[7]) * y + inverse[8];
+				std::vector<Pixel>& row = warpedPixels[y];
+				for (int x = 0; x < width; ++x)
+				{
+					if constexpr (Projective)
+					{
+						double invW = sw != 0.0 ? 1.0 / sw : 0.0;
+						row[x] = sw > 0.0 ? sample(static_cast<float>(sx * invW), static_cast<float>(sy * invW)) : border;
+						sw += stepW;
+					}
+					else
+					{
+						row[x] = sample(static_cast<float>(sx), static_cast<float>(sy));
+					}
+					sx += stepX;
+					sy += stepY;
+				}
+			}
+		});
+	};
+
+	switch (interpolation)
+	{
+	case Interpolation::Nearest:
+		run([&](float sx, float sy) { return sampleNearest(pixels, width, height, sx, sy, border); });
+		break;
+	case Interpolation::Bilinear:
+		run([&](float sx, float sy) { return sampleBilinear(pixels, width, height, sx, sy, border); });
+		break;
+	case Interpolation::Bicubic:
+		run([&](float sx, float sy) { return sampleBicubic(pixels, width, height, sx, sy, border); });
+		break;
+	}
+	pixels = std::move(warpedPixels);
+}
+
+// Blend ops
+// ------------------------------------------------------------------------------------
+// Each op combines one destination channel with one source channel. Ops that also provide an
+// SSE2 overload are run 16 channels (4 pixels) at a time by blendRow; the destination alpha
+// is always preserved. ImageData::compositeWith drives any op over a whole image.
+
+// Exact round(a * b / 255) for 8-bit a, b without a divide
+constexpr unsigned char mulDiv255(int a, int b)
+{
+	int t = a * b + 128;
+	return static_cast<unsigned char>((t + (t >> 8)) >> 8);
+}
+
+#ifdef IMAGEDATA_SSE2
+// Same rounding as mulDiv255 on eight 16-bit products
+__m128i mulDiv255Epi16(__m128i product)
+{
+	__m128i t = _mm_add_epi16(product, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__m128i mulDiv255Epu8(__m128i a, __m128i b)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = mulDiv255Epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+	__m128i hi = mulDiv255Epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+namespace BlendOps
+{
+	struct Multiply
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return mulDiv255(a, b); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const { return mulDiv255Epu8(a, b); }
+#endif
+	};
+
+	struct Screen
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(255 - mulDiv255(255 - a, 255 - b)); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const
+		{
+			const __m128i ones = _mm_set1_epi8(-1);
+			return _mm_xor_si128(ones, mulDiv255Epu8(_mm_xor_si128(ones, a), _mm_xor_si128(ones, b)));
+		}
+#endif
+	};
+
+	struct Overlay
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return a < 128 ? Multiply{}(a, b) : Screen{}(a, b); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const
+		{
+			// a < 128 exactly when its top bit is clear, i.e. it is non-negative as a signed byte
+			__m128i dark = _mm_cmpgt_epi8(a, _mm_set1_epi8(-1));
+			return _mm_or_si128(_mm_and_si128(dark, Multiply{}(a, b)), _mm_andnot_si128(dark, Screen{}(a, b)));
+		}
+#endif
+	};
+
+	struct Min
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return std::min(a, b); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const { return _mm_min_epu8(a, b); }
+#endif
+	};
+
+	struct Max
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return std::max(a, b); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const { return _mm_max_epu8(a, b); }
+#endif
+	};
 
-void ImageData::flipH()
-{
-	for (int y = 0; y < height; ++y)
+	// a + b * scale / 256 with saturation; scale is 8.8 fixed point in [0, 256]
+	struct Add
 	{
-		for (int x = 0; x < width / 2; ++x)
+		int scale{ 256 };
+
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(std::min(255, a + ((b * scale + 128) >> 8))); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const
 		{
-			std::swap(pixels[y][x], pixels[y][width - x - 1]);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i factor = _mm_set1_epi16(static_cast<short>(scale));
+			const __m128i round = _mm_set1_epi16(128);
+			__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), factor), round), 8);
+			__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), factor), round), 8);
+			return _mm_adds_epu8(a, _mm_packus_epi16(lo, hi));
 		}
-	}
-}
+#endif
+	};
 
-void ImageData::flipV()
-{
-	for (int y = 0; y < height / 2; ++y)
+	// (a * weight + b * (256 - weight)) / 256; weight is 8.8 fixed point in [0, 256]
+	struct Blend
 	{
-		for (int x = 0; x < width; ++x)
+		int weight{ 128 };
+
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>((a * weight + b * (256 - weight) + 128) >> 8); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const
 		{
-			std::swap(pixels[y][x], pixels[height - y - 1][x]);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i wa = _mm_set1_epi16(static_cast<short>(weight));
+			const __m128i wb = _mm_set1_epi16(static_cast<short>(256 - weight));
+			const __m128i round = _mm_set1_epi16(128);
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb));
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+			return _mm_packus_epi16(lo, hi);
 		}
-	}
-}
+#endif
+	};
 
-void ImageData::rotateR()
-{
-	Vector2D<Pixel> rotatedPixels(width, std::vector<Pixel>(height));
-	for (int y = 0; y < height; ++y)
+	// Extrapolating blend for alpha outside [0, 1]; scalar only
+	struct BlendScaled
 	{
-		for (int x = 0; x < width; ++x)
+		float alpha{ 0.5f };
+
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(std::clamp(alpha * a + (1 - alpha) * b, 0.0f, 255.0f)); }
+	};
+
+	// Arbitrary (including negative) float scale; scalar only
+	struct AddScaled
+	{
+		float scale{ 1.0f };
+
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(std::clamp(a + scale * b, 0.0f, 255.0f)); }
+	};
+
+	struct Subtract
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(a > b ? a - b : 0); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const { return _mm_subs_epu8(a, b); }
+#endif
+	};
+
+	struct Difference
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>(a > b ? a - b : b - a); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const { return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)); }
+#endif
+	};
+
+	// floor((a + b) / 2); pavgb rounds up, so the odd-sum case is corrected by one
+	struct Average
+	{
+		unsigned char operator()(unsigned char a, unsigned char b) const { return static_cast<unsigned char>((a + b) >> 1); }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i a, __m128i b) const
 		{
-			rotatedPixels[x][height - y - 1] = pixels[y][x];
+			__m128i odd = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+			return _mm_sub_epi8(_mm_avg_epu8(a, b), odd);
 		}
-	}
-	pixels = std::move(rotatedPixels);
-	std::swap(width, height);
+#endif
+	};
 }
 
-void ImageData::rotateL()
+template <typename Op>
+void blendRow(Pixel* dst, const Pixel* src, int count, const Op& op)
 {
-	Vector2D<Pixel> rotatedPixels(width, std::vector<Pixel>(height));
-	for (int y = 0; y < height; ++y)
+	int x = 0;
+#ifdef IMAGEDATA_SSE2
+	if constexpr (requires(__m128i v) { v = op(v, v); })
 	{
-		for (int x = 0; x < width; ++x)
+		static_assert(sizeof(Pixel) == 4, "SSE2 blend path assumes packed RGBA pixels");
+		const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+		for (; x + 4 <= count; x += 4)
 		{
-			rotatedPixels[width - x - 1][y] = pixels[y][x];
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+			__m128i result = op(a, b);
+			result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, a));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), result);
 		}
 	}
-	pixels = std::move(rotatedPixels);
-	std::swap(width, height);
+#endif
+	for (; x < count; ++x)
+	{
+		dst[x].r = op(dst[x].r, src[x].r);
+		dst[x].g = op(dst[x].g, src[x].g);
+		dst[x].b = op(dst[x].b, src[x].b);
+	}
 }
 
-constexpr int maxSize{ 4096 };
-void ImageData::resize(int w, int h)
+// Compositing Functions
+// ------------------------------------------------------------------------------------
+
+template <typename Op>
+void compositePlanes(PlanarImage<unsigned char>& image, const PlanarImage<unsigned char>& other, const Op& op, int planeCount)
 {
-	if (w <= 0 || w > maxSize || h <= 0 || h > maxSize) {
+	if (image.width != other.width || image.height != other.height || planeCount < 0 || planeCount > 4) {
 		throw std::invalid_argument("Invalid input");
 	}
-	Vector2D<Pixel> resizedPixels(h, std::vector<Pixel>(w));
-	float xRatio = static_cast<float>(width) / w;
-	float yRatio = static_cast<float>(height) / h;
-	for (int y = 0; y < h; ++y)
+	for (int p = 0; p < planeCount; ++p)
 	{
-		for (int x = 0; x < w; ++x)
+		parallelRows(image.height, [&](int y0, int y1)
 		{
-			int srcX = static_cast<int>(x * xRatio);
-			int srcY = static_cast<int>(y * yRatio);
-			resizedPixels[y][x] = pixels[srcY][srcX];
-		}
+			unsigned char* dst = image.row(p, y0);
+			const unsigned char* src = other.row(p, y0);
+			size_t count = static_cast<size_t>(y1 - y0) * image.width;
+			size_t i = 0;
+#ifdef IMAGEDATA_SSE2
+			if constexpr (requires(__m128i v) { v = op(v, v); })
+			{
+				for (; i + 16 <= count; i += 16)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), op(a, b));
+				}
+			}
+#endif
+			for (; i < count; ++i) {
+				dst[i] = op(dst[i], src[i]);
+			}
+		});
 	}
-	pixels = std::move(resizedPixels);
-	width = w;
-	height = h;
 }
 
-void ImageData::crop(int x, int y, int w, int h)
+template <typename Op>
+void ImageData::compositeWith(const ImageData& other, const Op& op, int x, int y)
 {
-	if (x < 0 || x > width) {
-		throw std::invalid_argument("Invalid input");
-	}
-	if (y < 0 || y > height) {
-		throw std::invalid_argument("Invalid input");
-	}
-	if (x + w > width) {
-		w = width - x;
-	}
-	if (y + h > height) {
-		h = height - y;
+	compositeWith(other, op, x, y, bounds());
+}
+
+template <typename Op>
+void ImageData::compositeWith(const ImageData& other, const Op& op, int x, int y, const Rect& clip)
+{
+	Rect area = intersect(intersect(clip, bounds()), { x, y, other.width, other.height });
+	if (area.empty()) {
+		return;
 	}
-	Vector2D<Pixel> croppedPixels(h, std::vector<Pixel>(w));
-	for (int i = 0; i < h; ++i)
+	parallelRows(area.height, [&](int r0, int r1)
 	{
-		for (int j = 0; j < w; ++j)
+		for (int row = area.y + r0; row < area.y + r1; ++row)
 		{
-			croppedPixels[i][j] = pixels[y + i][x + j];
+			blendRow(pixels[row].data() + area.x, other.pixels[row - y].data() + (area.x - x), area.width, op);
 		}
-	}
-	pixels = std::move(croppedPixels);
-	width = w;
-	height = h;
+	});
 }
 
-// Compositing Functions
-// ------------------------------------------------------------------------------------
-
-void ImageData::blend(const ImageData& other, float alpha)
+void ImageData::blend(const ImageData& other, float alpha, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to blend");
+	if (alpha >= 0.0f && alpha <= 1.0f) {
+		compositeWith(other, BlendOps::Blend{ static_cast<int>(alpha * 256.0f + 0.5f) }, x, y);
 	}
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			pixels[y][x].r = static_cast<unsigned char>(alpha * pixels[y][x].r + (1 - alpha) * other.pixels[y][x].r);
-			pixels[y][x].g = static_cast<unsigned char>(alpha * pixels[y][x].g + (1 - alpha) * other.pixels[y][x].g);
-			pixels[y][x].b = static_cast<unsigned char>(alpha * pixels[y][x].b + (1 - alpha) * other.pixels[y][x].b);
-		}
+	else {
+		compositeWith(other, BlendOps::BlendScaled{ alpha }, x, y);
 	}
 }
 
-void ImageData::compositeOver(const ImageData& background)
+// Premultiplied over: dst = fg + bg * (255 - fg.a) / 255 on all four channels, no divides.
+// dst may alias fg or bg.
+void compositeOverPremultipliedRow(Pixel* dst, const Pixel* fg, const Pixel* bg, int count)
 {
-	if (width != background.width || height != background.height)
+	int x = 0;
+#ifdef IMAGEDATA_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	auto inverseAlpha = [&](__m128i fg16)
+	{
+		// Broadcast each pixel's alpha (lanes 3 and 7) across its four channels
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(fg16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		return _mm_sub_epi16(full, alpha);
+	};
+	for (; x + 4 <= count; x += 4)
 	{
-		throw std::invalid_argument("Images must be the same dimensions to composite");
+		__m128i front = _mm_loadu_si128(reinterpret_cast<const __m128i*>(fg + x));
+		__m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + x));
+		__m128i lo = mulDiv255Epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(back, zero), inverseAlpha(_mm_unpacklo_epi8(front, zero))));
+		__m128i hi = mulDiv255Epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(back, zero), inverseAlpha(_mm_unpackhi_epi8(front, zero))));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_adds_epu8(front, _mm_packus_epi16(lo, hi)));
 	}
-	for (int y = 0; y < height; ++y)
+#endif
+	for (; x < count; ++x)
 	{
-		for (int x = 0; x < width; ++x)
-		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& bgPixel = background.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(pixel.r * pixel.a + bgPixel.r * (1 - pixel.a));
-			pixel.g = static_cast<unsigned char>(pixel.g * pixel.a + bgPixel.g * (1 - pixel.a));
-			pixel.b = static_cast<unsigned char>(pixel.b * pixel.a + bgPixel.b * (1 - pixel.a));
-		}
+		Pixel front = fg[x];
+		Pixel back = bg[x];
+		int inverse = 255 - front.a;
+		dst[x] = {
+			static_cast<unsigned char>(std::min(255, front.r + mulDiv255(back.r, inverse))),
+			static_cast<unsigned char>(std::min(255, front.g + mulDiv255(back.g, inverse))),
+			static_cast<unsigned char>(std::min(255, front.b + mulDiv255(back.b, inverse))),
+			static_cast<unsigned char>(std::min(255, front.a + mulDiv255(back.a, inverse)))
+		};
 	}
 }
 
-void ImageData::applyAlphaMask(const ImageData& mask)
+// Straight-alpha over; the colour result has to be divided back by the output alpha.
+// dst may alias fg or bg.
+void compositeOverStraightRow(Pixel* dst, const Pixel* fg, const Pixel* bg, int count)
 {
-	if (width != mask.width || height != mask.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to apply alpha mask");
-	}
-	for (int y = 0; y < height; ++y)
+	for (int x = 0; x < count; ++x)
 	{
-		for (int x = 0; x < width; ++x)
+		Pixel front = fg[x];
+		Pixel back = bg[x];
+		int fgWeight = front.a * 255;
+		int bgWeight = back.a * (255 - front.a);
+		int alphaSum = fgWeight + bgWeight;
+		if (alphaSum == 0)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& maskPixel = mask.pixels[y][x];
-			pixel.a = static_cast<unsigned char>(maskPixel.r);
+			dst[x] = {};
+			continue;
 		}
+		int half = alphaSum / 2;
+		dst[x] = {
+			static_cast<unsigned char>((front.r * fgWeight + back.r * bgWeight + half) / alphaSum),
+			static_cast<unsigned char>((front.g * fgWeight + back.g * bgWeight + half) / alphaSum),
+			static_cast<unsigned char>((front.b * fgWeight + back.b * bgWeight + half) / alphaSum),
+			static_cast<unsigned char>((alphaSum + 127) / 255)
+		};
 	}
 }
 
-void ImageData::multiply(const ImageData& other)
+void ImageData::compositeOver(const ImageData& background, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to multiply");
+	Rect area = intersect(bounds(), { x, y, background.width, background.height });
+	if (area.empty()) {
+		return;
 	}
-	for (int y = 0; y < height; ++y)
+	parallelRows(area.height, [&](int r0, int r1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int row = area.y + r0; row < area.y + r1; ++row)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(pixel.r * otherPixel.r / 255);
-			pixel.g = static_cast<unsigned char>(pixel.g * otherPixel.g / 255);
-			pixel.b = static_cast<unsigned char>(pixel.b * otherPixel.b / 255);
+			Pixel* dst = pixels[row].data() + area.x;
+			compositeOverStraightRow(dst, dst, background.pixels[row - y].data() + (area.x - x), area.width);
 		}
-	}
+	});
 }
 
-void ImageData::screen(const ImageData& other)
+void ImageData::drawOver(const ImageData& overlay, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to screen");
+	Rect area = intersect(bounds(), { x, y, overlay.width, overlay.height });
+	if (area.empty()) {
+		return;
 	}
-	for (int y = 0; y < height; ++y)
+	parallelRows(area.height, [&](int r0, int r1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int row = area.y + r0; row < area.y + r1; ++row)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(255 - ((255 - pixel.r) * (255 - otherPixel.r)) / 255);
-			pixel.g = static_cast<unsigned char>(255 - ((255 - pixel.g) * (255 - otherPixel.g)) / 255);
-			pixel.b = static_cast<unsigned char>(255 - ((255 - pixel.b) * (255 - otherPixel.b)) / 255);
+			Pixel* dst = pixels[row].data() + area.x;
+			compositeOverStraightRow(dst, overlay.pixels[row - y].data() + (area.x - x), dst, area.width);
 		}
-	}
+	});
 }
 
-void ImageData::overlay(const ImageData& other)
+PremultipliedImage::PremultipliedImage(const ImageData& straight)
+	: width{ straight.getWidth() }, height{ straight.getHeight() }, pixels(height, std::vector<Pixel>(width))
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to overlay");
-	}
-	for (int y = 0; y < height; ++y)
+	parallelRows(height, [&](int y0, int y1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int y = y0; y < y1; ++y)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			if (pixel.r < 128)
-			{
-				pixel.r = static_cast<unsigned char>(pixel.r * otherPixel.r / 255);
-			}
-			else
-			{
-				pixel.r = static_cast<unsigned char>(255 - ((255 - pixel.r) * (255 - otherPixel.r)) / 255);
-			}
-			if (pixel.g < 128)
-			{
-				pixel.g = static_cast<unsigned char>(pixel.g * otherPixel.g / 255);
-			}
-			else
-			{
-				pixel.g = static_cast<unsigned char>(255 - ((255 - pixel.g) * (255 - otherPixel.g)) / 255);
-			}
-			if (pixel.b < 128)
+			for (int x = 0; x < width; ++x)
 			{
-				pixel.b = static_cast<unsigned char>(pixel.b * otherPixel.b / 255);
-			}
-			else
-			{
-				pixel.b = static_cast<unsigned char>(255 - ((255 - pixel.b) * (255 - otherPixel.b)) / 255);
+				const Pixel& pixel = straight.getPixel(y, x);
+				pixels[y][x] = { mulDiv255(pixel.r, pixel.a), mulDiv255(pixel.g, pixel.a), mulDiv255(pixel.b, pixel.a), pixel.a };
 			}
 		}
-	}
+	});
 }
 
-void ImageData::darken(const ImageData& other)
+void PremultipliedImage::compositeOver(const PremultipliedImage& background, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to darken");
+	Rect area = intersect(bounds(), { x, y, background.width, background.height });
+	if (area.empty()) {
+		return;
 	}
-	for (int y = 0; y < height; ++y)
+	parallelRows(area.height, [&](int r0, int r1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int row = area.y + r0; row < area.y + r1; ++row)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = std::min(pixel.r, otherPixel.r);
-			pixel.g = std::min(pixel.g, otherPixel.g);
-			pixel.b = std::min(pixel.b, otherPixel.b);
+			Pixel* dst = pixels[row].data() + area.x;
+			compositeOverPremultipliedRow(dst, dst, background.pixels[row - y].data() + (area.x - x), area.width);
 		}
-	}
+	});
 }
 
-void ImageData::lighten(const ImageData& other)
+void PremultipliedImage::drawOver(const PremultipliedImage& overlay, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to lighten");
+	Rect area = intersect(bounds(), { x, y, overlay.width, overlay.height });
+	if (area.empty()) {
+		return;
 	}
-	for (int y = 0; y < height; ++y)
+	parallelRows(area.height, [&](int r0, int r1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int row = area.y + r0; row < area.y + r1; ++row)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = std::max(pixel.r, otherPixel.r);
-			pixel.g = std::max(pixel.g, otherPixel.g);
-			pixel.b = std::max(pixel.b, otherPixel.b);
+			Pixel* dst = pixels[row].data() + area.x;
+			compositeOverPremultipliedRow(dst, overlay.pixels[row - y].data() + (area.x - x), dst, area.width);
 		}
-	}
+	});
 }
 
-void ImageData::add(const ImageData& other, float scale)
+ImageData PremultipliedImage::toStraight() const
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to add");
-	}
-	for (int y = 0; y < height; ++y)
+	ImageData straight(width, height);
+	parallelRows(height, [&](int y0, int y1)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int y = y0; y < y1; ++y)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::clamp(pixel.r + scale * otherPixel.r, 0.0f, 255.0f));
-			pixel.g = static_cast<unsigned char>(std::clamp(pixel.g + scale * otherPixel.g, 0.0f, 255.0f));
-			pixel.b = static_cast<unsigned char>(std::clamp(pixel.b + scale * otherPixel.b, 0.0f, 255.0f));
+			for (int x = 0; x < width; ++x) {
+				straight.getPixel(y, x) = straightAlpha(pixels[y][x]);
+			}
 		}
-	}
+	});
+	return straight;
 }
 
-void ImageData::subtract(const ImageData& other)
+void ImageData::applyAlphaMask(const ImageData& mask, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to subtract");
-	}
-	for (int y = 0; y < height; ++y)
+	Rect area = intersect(bounds(), { x, y, mask.width, mask.height });
+	for (int row = area.y; row < area.y + area.height; ++row)
 	{
-		for (int x = 0; x < width; ++x)
+		for (int col = area.x; col < area.x + area.width; ++col)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::clamp(pixel.r - otherPixel.r, 0, 255));
-			pixel.g = static_cast<unsigned char>(std::clamp(pixel.g - otherPixel.g, 0, 255));
-			pixel.b = static_cast<unsigned char>(std::clamp(pixel.b - otherPixel.b, 0, 255));
+			Pixel& pixel = pixels[row][col];
+			const Pixel& maskPixel = mask.pixels[row - y][col - x];
+			pixel.a = static_cast<unsigned char>(maskPixel.r);
 		}
 	}
 }
 
-void ImageData::difference(const ImageData& other)
+void ImageData::multiply(const ImageData& other, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to find difference");
+	compositeWith(other, BlendOps::Multiply{}, x, y);
+}
+
+void ImageData::screen(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Screen{}, x, y);
+}
+
+void ImageData::overlay(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Overlay{}, x, y);
+}
+
+void ImageData::darken(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Min{}, x, y);
+}
+
+void ImageData::lighten(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Max{}, x, y);
+}
+
+void ImageData::add(const ImageData& other, float scale, int x, int y)
+{
+	if (scale >= 0.0f && scale <= 1.0f) {
+		compositeWith(other, BlendOps::Add{ static_cast<int>(scale * 256.0f + 0.5f) }, x, y);
 	}
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = 0; x < width; ++x)
-		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>(std::abs(pixel.r - otherPixel.r));
-			pixel.g = static_cast<unsigned char>(std::abs(pixel.g - otherPixel.g));
-			pixel.b = static_cast<unsigned char>(std::abs(pixel.b - otherPixel.b));
-		}
+	else {
+		compositeWith(other, BlendOps::AddScaled{ scale }, x, y);
 	}
 }
 
-void ImageData::average(const ImageData& other)
+void ImageData::subtract(const ImageData& other, int x, int y)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to average");
+	compositeWith(other, BlendOps::Subtract{}, x, y);
+}
+
+void ImageData::difference(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Difference{}, x, y);
+}
+
+void ImageData::average(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Average{}, x, y);
+}
+
+void ImageData::max(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Max{}, x, y);
+}
+
+void ImageData::min(const ImageData& other, int x, int y)
+{
+	compositeWith(other, BlendOps::Min{}, x, y);
+}
+
+// Convolution Functions
+// ------------------------------------------------------------------------------------
+
+void ImageData::boxBlur(int radius)
+{
+	if (radius < 0) {
+		throw std::invalid_argument("Invalid input");
 	}
-	for (int y = 0; y < height; ++y)
+	if (radius == 0) {
+		return;
+	}
+	int window = 2 * radius + 1;
+	Vector2D<Pixel> result(height, std::vector<Pixel>(width));
+	auto blur = [&](const auto& integral)
 	{
-		for (int x = 0; x < width; ++x)
+		parallelRows(height, [&](int y0, int y1)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = static_cast<unsigned char>((pixel.r + otherPixel.r) / 2);
-			pixel.g = static_cast<unsigned char>((pixel.g + otherPixel.g) / 2);
-			pixel.b = static_cast<unsigned char>((pixel.b + otherPixel.b) / 2);
-		}
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = 0; x < width; ++x)
+				{
+					Rect box = intersect(bounds(), { x - radius, y - radius, window, window });
+					std::uint64_t area = static_cast<std::uint64_t>(box.width) * box.height;
+					auto mean = [&](int channel)
+					{
+						return static_cast<unsigned char>((static_cast<std::uint64_t>(integral.boxSum(box, channel)) + area / 2) / area);
+					};
+					result[y][x] = { mean(0), mean(1), mean(2), pixels[y][x].a };
+				}
+			}
+		});
+	};
+	// 32-bit sums halve the table when no window can reach 2^32
+	if (fitsUint32Box(*this, window, window)) {
+		blur(IntegralImage<std::uint32_t>(*this));
 	}
+	else {
+		blur(IntegralImage<std::uint64_t>(*this));
+	}
+	pixels = std::move(result);
 }
 
-void ImageData::max(const ImageData& other)
+template <typename T>
+void convolvePlanes(PlanarImage<T>& image, const ImageData::DynamicKernel& kernel, int planeCount)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to find max");
+	int rows = static_cast<int>(kernel.size());
+	if (rows == 0 || kernel[0].empty()) {
+		throw std::invalid_argument("Invalid kernel size");
 	}
-	for (int y = 0; y < height; ++y)
+	if (planeCount < 0 || planeCount > 4) {
+		throw std::invalid_argument("Invalid plane count");
+	}
+	int cols = static_cast<int>(kernel[0].size());
+	int width = image.width;
+	int height = image.height;
+	for (int p = 0; p < planeCount; ++p)
 	{
-		for (int x = 0; x < width; ++x)
+		std::vector<T> result(image.planes[p].size());
+		parallelRows(height, [&](int y0, int y1)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = std::max(pixel.r, otherPixel.r);
-			pixel.g = std::max(pixel.g, otherPixel.g);
-			pixel.b = std::max(pixel.b, otherPixel.b);
-		}
+			std::vector<float> sums(width);
+			for (int y = y0; y < y1; ++y)
+			{
+				std::fill(sums.begin(), sums.end(), 0.0f);
+				// Taps are accumulated in the same (row, column) order as applyKernel; padded
+				// taps contribute zero and are simply skipped
+				for (int i = 0; i < rows; ++i)
+				{
+					int sourceY = y + i - rows / 2;
+					if (sourceY < 0 || sourceY >= height) {
+						continue;
+					}
+					const T* source = image.row(p, sourceY);
+					for (int j = 0; j < cols; ++j)
+					{
+						int dx = j - cols / 2;
+						float weight = kernel[i][j];
+						int x1 = std::min(width, width - dx);
+						for (int x = std::max(0, -dx); x < x1; ++x) {
+							sums[x] += weight * source[x + dx];
+						}
+					}
+				}
+				T* target = result.data() + static_cast<size_t>(y) * width;
+				for (int x = 0; x < width; ++x) {
+					target[x] = toSample<T>(sums[x]);
+				}
+			}
+		});
+		image.planes[p] = std::move(result);
 	}
 }
 
-void ImageData::min(const ImageData& other)
+template <typename T>
+void contrastPlanes(PlanarImage<T>& image, float factor, int planeCount)
 {
-	if (width != other.width || height != other.height)
-	{
-		throw std::invalid_argument("Images must be the same dimensions to find min");
+	if (planeCount < 0 || planeCount > 4) {
+		throw std::invalid_argument("Invalid plane count");
 	}
-	for (int y = 0; y < height; ++y)
+	for (int p = 0; p < planeCount; ++p)
 	{
-		for (int x = 0; x < width; ++x)
+		parallelRows(image.height, [&](int y0, int y1)
 		{
-			Pixel& pixel = pixels[y][x];
-			const Pixel& otherPixel = other.pixels[y][x];
-			pixel.r = std::min(pixel.r, otherPixel.r);
-			pixel.g = std::min(pixel.g, otherPixel.g);
-			pixel.b = std::min(pixel.b, otherPixel.b);
-		}
+			T* samples = image.row(p, y0);
+			size_t count = static_cast<size_t>(y1 - y0) * image.width;
+			for (size_t i = 0; i < count; ++i) {
+				samples[i] = toSample<T>(samples[i] * factor);
+			}
+		});
 	}
 }
 
-// Convolution Functions
-// ------------------------------------------------------------------------------------
-
 template<size_t N>
 void ImageData::applyKernel(const Kernel<N>& kernel) 
 {
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "ImageData.h"
+
+#include <atomic>
+#include <vector>
+
+enum class BlendMode { Normal, Multiply, Screen, Overlay, Darken, Lighten, Add, Subtract, Difference, Average };
+
+namespace BlendOps
+{
+	// Plain replacement; the layer's alpha, opacity and mask decide how much shows through
+	struct Normal
+	{
+		unsigned char operator()(unsigned char, unsigned char b) const { return b; }
+#ifdef IMAGEDATA_SSE2
+		__m128i operator()(__m128i, __m128i b) const { return b; }
+#endif
+	};
+}
+
+// A layer placed at (x, y) on the canvas. The image and optional mask are not owned and must
+// outlive the stack; the mask's red channel scales coverage and must match the image size.
+struct Layer
+{
+	const ImageData* image{};
+	BlendMode mode{ BlendMode::Normal };
+	float opacity{ 1.0f };
+	const ImageData* mask{};
+	int x{};
+	int y{};
+};
+
+class LayerStack
+{
+
+private:
+	std::vector<Layer> layers{};
+
+public:
+	// Canvas tiles are rendered through every layer before moving on, so each tile's pixels stay
+	// in cache for the whole stack instead of being re-read once per layer
+	static constexpr int tileSize{ 64 };
+
+	void addLayer(const Layer& layer);
+
+	void clear() { layers.clear(); }
+
+	int size() const { return static_cast<int>(layers.size()); }
+
+	// Composites all layers, bottom (first added) to top, onto canvas in one pass
+	void render(ImageData& canvas) const;
+};
+
+// Layer compositing
+// ------------------------------------------------------------------------------------
+
+void LayerStack::addLayer(const Layer& layer)
+{
+	if (!layer.image) {
+		throw std::invalid_argument("Layer has no image");
+	}
+	if (layer.mask && (layer.mask->getWidth() != layer.image->getWidth() || layer.mask->getHeight() != layer.image->getHeight()))
+	{
+		throw std::invalid_argument("Layer mask must be the same dimensions as the layer image");
+	}
+	layers.push_back(layer);
+}
+
+// Blends a span with op (SIMD when available), then composites the result "over" the canvas
+// with coverage = opacity * source alpha * mask as its alpha. As in the W3C compositing model
+// the blended colour only counts where the canvas is opaque (the plain source colour shows
+// elsewhere), and colours are weighted by alpha so invisible canvas pixels never bleed in.
+template <typename Op>
+void compositeLayerSpan(Pixel* dst, const Pixel* src, const Pixel* mask, int count, int opacity, const Op& op, std::vector<Pixel>& scratch)
+{
+	scratch.assign(dst, dst + count);
+	blendRow(scratch.data(), src, count, op);
+	for (int x = 0; x < count; ++x)
+	{
+		int coverage = mulDiv255(opacity, src[x].a);
+		if (mask) {
+			coverage = mulDiv255(coverage, mask[x].r);
+		}
+		if (coverage == 0) {
+			continue;
+		}
+		Pixel& out = dst[x];
+		const Pixel& blended = scratch[x];
+		int backAlpha = out.a;
+		int fgWeight = coverage * 255;
+		int bgWeight = backAlpha * (255 - coverage);
+		int alphaSum = fgWeight + bgWeight;
+		int half = alphaSum / 2;
+		auto mix = [&](int source, int mixed, int back)
+		{
+			int front = std::min(255, mulDiv255(source, 255 - backAlpha) + mulDiv255(mixed, backAlpha));
+			return static_cast<unsigned char>((front * fgWeight + back * bgWeight + half) / alphaSum);
+		};
+		out.r = mix(src[x].r, blended.r, out.r);
+		out.g = mix(src[x].g, blended.g, out.g);
+		out.b = mix(src[x].b, blended.b, out.b);
+		out.a = static_cast<unsigned char>((alphaSum + 127) / 255);
+	}
+}
+
+void LayerStack::render(ImageData& canvas) const
+{
+	int width = canvas.getWidth();
+	int height = canvas.getHeight();
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	int tileCount = tilesX * tilesY;
+	if (tileCount == 0 || layers.empty()) {
+		return;
+	}
+
+	std::atomic<int> nextTile{ 0 };
+	parallelFor(std::min(workerCount(), tileCount), [&](int)
+	{
+		std::vector<Pixel> scratch;
+		for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+		{
+			Rect tileRect = intersect(canvas.bounds(), { (tile % tilesX) * tileSize, (tile / tilesX) * tileSize, tileSize, tileSize });
+
+			for (const Layer& layer : layers)
+			{
+				Rect area = intersect(tileRect, { layer.x, layer.y, layer.image->getWidth(), layer.image->getHeight() });
+				if (area.empty()) {
+					continue;
+				}
+
+				int opacity = static_cast<int>(std::clamp(layer.opacity, 0.0f, 1.0f) * 255.0f + 0.5f);
+				for (int y = area.y; y < area.y + area.height; ++y)
+				{
+					Pixel* dst = &canvas.getPixel(y, area.x);
+					const Pixel* src = &layer.image->getPixel(y - layer.y, area.x - layer.x);
+					const Pixel* mask = layer.mask ? &layer.mask->getPixel(y - layer.y, area.x - layer.x) : nullptr;
+					int count = area.width;
+					switch (layer.mode)
+					{
+					case BlendMode::Normal:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Normal{}, scratch);
+						break;
+					case BlendMode::Multiply:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Multiply{}, scratch);
+						break;
+					case BlendMode::Screen:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Screen{}, scratch);
+						break;
+					case BlendMode::Overlay:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Overlay{}, scratch);
+						break;
+					case BlendMode::Darken:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Min{}, scratch);
+						break;
+					case BlendMode::Lighten:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Max{}, scratch);
+						break;
+					case BlendMode::Add:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Add{}, scratch);
+						break;
+					case BlendMode::Subtract:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Subtract{}, scratch);
+						break;
+					case BlendMode::Difference:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Difference{}, scratch);
+						break;
+					case BlendMode::Average:
+						compositeLayerSpan(dst, src, mask, count, opacity, BlendOps::Average{}, scratch);
+						break;
+					}
+				}
+			}
+		}
+	});
+}
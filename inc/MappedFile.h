@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-ahead hint: decoders scan front to back, region reads jump between tiles
+enum class FileAccess { Sequential, Random };
+
+// Read-only memory mapping of a whole file. Pages are faulted in straight from the page cache,
+// so decoders read the file without a copy into a stdio buffer. Files that cannot be mapped
+// (pipes, devices) are read into an owned buffer instead. The memory is released by unmap()
+// or the destructor, whichever comes first.
+class MappedFile
+{
+
+private:
+	const std::byte* data{};
+	size_t size{};
+	bool mapped{};
+	std::vector<std::byte> fallback{};
+
+public:
+	explicit MappedFile(const char* path, FileAccess access = FileAccess::Sequential);
+	~MappedFile() { unmap(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Empty for an empty file or after unmap()
+	std::span<const std::byte> bytes() const { return { data, size }; }
+
+	void unmap();
+};
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char* path, FileAccess access)
+{
+	DWORD flags = access == FileAccess::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Failed to open file");
+	}
+	LARGE_INTEGER length{};
+	if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &length) && length.QuadPart > 0)
+	{
+		// The view keeps its own reference to the mapping, so both handles can be closed right away
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			data = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			CloseHandle(mapping);
+		}
+		mapped = data != nullptr;
+		size = mapped ? static_cast<size_t>(length.QuadPart) : 0;
+	}
+	if (!mapped)
+	{
+		std::byte chunk[65536];
+		DWORD count = 0;
+		while (true)
+		{
+			if (!ReadFile(file, chunk, sizeof(chunk), &count, nullptr))
+			{
+				// A closed pipe is the end of its data; anything else would leave the buffer truncated
+				if (GetLastError() == ERROR_BROKEN_PIPE) {
+					break;
+				}
+				CloseHandle(file);
+				throw std::runtime_error("Failed to read file");
+			}
+			if (count == 0) {
+				break;
+			}
+			fallback.insert(fallback.end(), chunk, chunk + count);
+		}
+		data = fallback.data();
+		size = fallback.size();
+	}
+	CloseHandle(file);
+}
+
+void MappedFile::unmap()
+{
+	if (mapped) {
+		UnmapViewOfFile(data);
+	}
+	mapped = false;
+	fallback = {};
+	data = nullptr;
+	size = 0;
+}
+
+#else
+
+MappedFile::MappedFile(const char* path, FileAccess access)
+{
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to open file");
+	}
+	struct stat info {};
+	if (::fstat(fd, &info) != 0 || S_ISDIR(info.st_mode))
+	{
+		::close(fd);
+		throw std::runtime_error("Failed to open file");
+	}
+	if (S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		void* mapping = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			// Front-to-back readers get aggressive read-ahead; random ones fault in only what they touch
+			::madvise(mapping, static_cast<size_t>(info.st_size), access == FileAccess::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+			data = static_cast<const std::byte*>(mapping);
+			size = static_cast<size_t>(info.st_size);
+			mapped = true;
+		}
+	}
+	if (!mapped)
+	{
+		std::byte chunk[65536];
+		while (true)
+		{
+			ssize_t count = ::read(fd, chunk, sizeof(chunk));
+			if (count < 0)
+			{
+				// Interrupted reads are retried; a real error must not pass for end of file
+				if (errno == EINTR) {
+					continue;
+				}
+				::close(fd);
+				throw std::runtime_error("Failed to read file");
+			}
+			if (count == 0) {
+				break;
+			}
+			fallback.insert(fallback.end(), chunk, chunk + count);
+		}
+		data = fallback.data();
+		size = fallback.size();
+	}
+	// A mapping outlives its descriptor
+	::close(fd);
+}
+
+void MappedFile::unmap()
+{
+	if (mapped) {
+		::munmap(const_cast<std::byte*>(data), size);
+	}
+	mapped = false;
+	fallback = {};
+	data = nullptr;
+	size = 0;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Row-parallel helpers. Work is split into contiguous bands of rows, one per hardware thread,
+// and images too small to be worth the thread start-up run on the calling thread.
+// --------------------------------------------------------------------------------
+
+constexpr int minRowsPerBand{ 16 };
+
+int workerCount()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : static_cast<int>(count);
+}
+
+int rowBandCount(int rows)
+{
+	return std::clamp(rows / minRowsPerBand, 1, workerCount());
+}
+
+// Runs fn(i) for i in [0, count) concurrently, with i == 0 on the calling thread.
+// The first exception thrown by any task is rethrown once every task has finished.
+template <typename Fn>
+void parallelFor(int count, Fn&& fn)
+{
+	if (count <= 1)
+	{
+		if (count == 1) {
+			fn(0);
+		}
+		return;
+	}
+
+	std::exception_ptr error{};
+	std::mutex errorMutex;
+	auto task = [&](int i)
+	{
+		try {
+			fn(i);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(count - 1);
+	for (int i = 1; i < count; ++i)
+	{
+		threads.emplace_back(task, i);
+	}
+	task(0);
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// Runs fn(band, y0, y1) over [0, rows) split into rowBandCount(rows) bands
+template <typename Fn>
+void parallelBands(int rows, Fn&& fn)
+{
+	int bands = rowBandCount(rows);
+	parallelFor(bands, [&](int band)
+	{
+		fn(band, rows * band / bands, rows * (band + 1) / bands);
+	});
+}
+
+// Runs fn(y0, y1) over [0, rows) split into row bands
+template <typename Fn>
+void parallelRows(int rows, Fn&& fn)
+{
+	parallelBands(rows, [&](int, int y0, int y1) { fn(y0, y1); });
+}
@@ -0,0 +1,1041 @@
+#pragma once
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Per-scanline filter. Adaptive tries all five and keeps the one with the smallest sum of
+// absolute (signed) residuals, the heuristic libpng uses; palette images always use None.
+enum class PngFilter { None, Sub, Up, Average, Paeth, Adaptive };
+
+struct PngOptions
+{
+	// 0 stores without compression, 1 is fastest, 9 searches hardest
+	int level{ 6 };
+	PngFilter filter{ PngFilter::Adaptive };
+	// Scanlines per independently compressed stripe; 0 picks about 128 KiB of image data per stripe
+	int stripeRows{ 0 };
+};
+
+// PNG container helpers
+// --------------------------------------------------------------------------------
+
+constexpr std::array<std::uint32_t, 256> makeCrcTable()
+{
+	std::array<std::uint32_t, 256> table{};
+	for (std::uint32_t i = 0; i < 256; ++i)
+	{
+		std::uint32_t c = i;
+		for (int k = 0; k < 8; ++k)
+		{
+			c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		table[i] = c;
+	}
+	return table;
+}
+
+constexpr std::array<std::uint32_t, 256> crcTable = makeCrcTable();
+
+std::uint32_t crc32(const unsigned char* data, size_t length, std::uint32_t crc = 0)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < length; ++i)
+	{
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+void appendBigEndian(std::vector<unsigned char>& out, std::uint32_t value)
+{
+	out.push_back(static_cast<unsigned char>(value >> 24));
+	out.push_back(static_cast<unsigned char>(value >> 16));
+	out.push_back(static_cast<unsigned char>(value >> 8));
+	out.push_back(static_cast<unsigned char>(value));
+}
+
+// Length, type, data and the CRC over type + data
+void appendPngChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t length)
+{
+	appendBigEndian(out, static_cast<std::uint32_t>(length));
+	size_t typeStart = out.size();
+	out.insert(out.end(), type, type + 4);
+	if (length > 0) {
+		out.insert(out.end(), data, data + length);
+	}
+	appendBigEndian(out, crc32(out.data() + typeStart, length + 4));
+}
+
+void appendPngSignature(std::vector<unsigned char>& out)
+{
+	static constexpr unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	out.insert(out.end(), signature, signature + 8);
+}
+
+void appendPngHeader(std::vector<unsigned char>& out, int width, int height, unsigned char colorType, unsigned char bitDepth = 8)
+{
+	std::vector<unsigned char> header;
+	appendBigEndian(header, static_cast<std::uint32_t>(width));
+	appendBigEndian(header, static_cast<std::uint32_t>(height));
+	header.push_back(bitDepth);
+	header.push_back(colorType);
+	header.push_back(0);            // deflate
+	header.push_back(0);            // adaptive filtering
+	header.push_back(0);            // no interlace
+	appendPngChunk(out, "IHDR", header.data(), header.size());
+}
+
+// Deflate
+// --------------------------------------------------------------------------------
+// A self-contained deflate (RFC 1951) encoder: hash-chain LZ77 with optional lazy matching and
+// dynamic Huffman blocks, falling back to stored blocks when those are smaller. Stripes of the
+// input are compressed independently, pigz-style: each one ends with a sync flush (an empty
+// stored block) so the byte-aligned results simply concatenate, and each one primes its match
+// finder with the 32 KiB before it, so stripes still reference earlier data.
+
+class BitWriter
+{
+
+private:
+	std::vector<unsigned char>& out;
+	std::uint64_t buffer{};
+	int count{};
+
+public:
+	explicit BitWriter(std::vector<unsigned char>& target) : out{ target } {}
+
+	// Appends the low `length` bits of value, least significant first (length <= 32)
+	void write(std::uint32_t value, int length)
+	{
+		buffer |= static_cast<std::uint64_t>(value) << count;
+		count += length;
+		while (count >= 8)
+		{
+			out.push_back(static_cast<unsigned char>(buffer));
+			buffer >>= 8;
+			count -= 8;
+		}
+	}
+
+	void alignToByte()
+	{
+		if (count > 0) {
+			out.push_back(static_cast<unsigned char>(buffer));
+		}
+		buffer = 0;
+		count = 0;
+	}
+
+	// Only valid on a byte boundary
+	void writeBytes(const unsigned char* data, size_t length)
+	{
+		out.insert(out.end(), data, data + length);
+	}
+};
+
+constexpr int deflateWindow{ 32768 };
+constexpr int maxMatchLength{ 258 };
+constexpr int minMatchLength{ 3 };
+constexpr int endOfBlock{ 256 };
+constexpr int literalLengthCodes{ 286 };
+constexpr int distanceCodes{ 30 };
+
+constexpr std::array<int, 29> lengthBase{ 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr std::array<int, 29> lengthExtraBits{ 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr std::array<int, 30> distanceBase{ 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr std::array<int, 30> distanceExtraBits{ 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Order in which code-length code lengths are transmitted
+constexpr std::array<int, 19> codeLengthOrder{ 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// Length code (0-28) for every match length 3-258
+constexpr std::array<unsigned char, maxMatchLength + 1> makeLengthCodes()
+{
+	std::array<unsigned char, maxMatchLength + 1> codes{};
+	for (int code = 0; code < 29; ++code)
+	{
+		for (int length = lengthBase[code]; length < (code == 28 ? 259 : lengthBase[code + 1]); ++length) {
+			codes[length] = static_cast<unsigned char>(code);
+		}
+	}
+	return codes;
+}
+
+constexpr std::array<unsigned char, maxMatchLength + 1> lengthCodes = makeLengthCodes();
+
+// Distance code (0-29) for distances 1-256 directly and for larger ones by (distance - 1) >> 7, as in zlib
+constexpr std::array<unsigned char, 512> makeDistanceCodes()
+{
+	std::array<unsigned char, 512> codes{};
+	for (int code = 0; code < 30; ++code)
+	{
+		int end = code == 29 ? deflateWindow + 1 : distanceBase[code + 1];
+		for (int distance = distanceBase[code]; distance < end; ++distance)
+		{
+			int index = distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7);
+			codes[index] = static_cast<unsigned char>(code);
+		}
+	}
+	return codes;
+}
+
+constexpr std::array<unsigned char, 512> distanceCodeTable = makeDistanceCodes();
+
+constexpr int distanceCode(int distance)
+{
+	return distance <= 256 ? distanceCodeTable[distance - 1] : distanceCodeTable[256 + ((distance - 1) >> 7)];
+}
+
+// A literal (distance == 0) or a back-reference of litLen bytes
+struct LzSymbol
+{
+	std::uint16_t litLen{};
+	std::uint16_t distance{};
+};
+
+// Huffman code lengths no longer than maxBits. An over-deep tree is repaired as miniz does: lengths are
+// clamped, then codes are lengthened one at a time until the Kraft sum is exactly one again.
+void huffmanLengths(const std::uint32_t* frequencies, int count, int maxBits, unsigned char* lengths)
+{
+	std::fill(lengths, lengths + count, static_cast<unsigned char>(0));
+	std::vector<int> symbols;
+	for (int i = 0; i < count; ++i)
+	{
+		if (frequencies[i] != 0) {
+			symbols.push_back(i);
+		}
+	}
+	if (symbols.empty()) {
+		return;
+	}
+	if (symbols.size() == 1)
+	{
+		lengths[symbols[0]] = 1;
+		return;
+	}
+
+	// Leaves first, then internal nodes in creation order, so the root is last
+	std::vector<int> parent(symbols.size() * 2 - 1, -1);
+	using Entry = std::pair<std::uint64_t, int>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		heap.emplace(frequencies[symbols[i]], static_cast<int>(i));
+	}
+	int next = static_cast<int>(symbols.size());
+	while (heap.size() > 1)
+	{
+		Entry a = heap.top();
+		heap.pop();
+		Entry b = heap.top();
+		heap.pop();
+		parent[a.second] = next;
+		parent[b.second] = next;
+		heap.emplace(a.first + b.first, next++);
+	}
+	std::vector<int> depth(parent.size(), 0);
+	std::array<int, 16> lengthCounts{};
+	for (int node = static_cast<int>(parent.size()) - 2; node >= 0; --node)
+	{
+		depth[node] = depth[parent[node]] + 1;
+		if (node < static_cast<int>(symbols.size())) {
+			++lengthCounts[std::min(depth[node], maxBits)];
+		}
+	}
+
+	std::uint32_t kraft = 0;
+	for (int bits = 1; bits <= maxBits; ++bits) {
+		kraft += static_cast<std::uint32_t>(lengthCounts[bits]) << (maxBits - bits);
+	}
+	while (kraft != (1u << maxBits))
+	{
+		--lengthCounts[maxBits];
+		for (int bits = maxBits - 1; bits > 0; --bits)
+		{
+			if (lengthCounts[bits] != 0)
+			{
+				--lengthCounts[bits];
+				lengthCounts[bits + 1] += 2;
+				break;
+			}
+		}
+		--kraft;
+	}
+
+	// The most frequent symbols get the shortest codes
+	std::stable_sort(symbols.begin(), symbols.end(), [&](int a, int b) { return frequencies[a] > frequencies[b]; });
+	size_t index = 0;
+	for (int bits = 1; bits <= maxBits; ++bits)
+	{
+		for (int k = 0; k < lengthCounts[bits]; ++k) {
+			lengths[symbols[index++]] = static_cast<unsigned char>(bits);
+		}
+	}
+}
+
+// Canonical codes, bit-reversed so BitWriter can emit them least significant bit first
+void canonicalCodes(const unsigned char* lengths, int count, std::uint16_t* codes)
+{
+	std::array<int, 16> lengthCounts{};
+	for (int i = 0; i < count; ++i) {
+		++lengthCounts[lengths[i]];
+	}
+	lengthCounts[0] = 0;
+	std::array<int, 16> nextCode{};
+	int code = 0;
+	for (int bits = 1; bits < 16; ++bits)
+	{
+		code = (code + lengthCounts[bits - 1]) << 1;
+		nextCode[bits] = code;
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		int length = lengths[i];
+		if (length == 0) {
+			continue;
+		}
+		int value = nextCode[length]++;
+		int reversed = 0;
+		for (int bit = 0; bit < length; ++bit) {
+			reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+		}
+		codes[i] = static_cast<std::uint16_t>(reversed);
+	}
+}
+
+void writeStoredBlocks(BitWriter& bits, const unsigned char* data, size_t length)
+{
+	do
+	{
+		size_t chunk = std::min<size_t>(length, 65535);
+		bits.write(0, 3);
+		bits.alignToByte();
+		unsigned char header[4] = {
+			static_cast<unsigned char>(chunk), static_cast<unsigned char>(chunk >> 8),
+			static_cast<unsigned char>(~chunk), static_cast<unsigned char>(~chunk >> 8)
+		};
+		bits.writeBytes(header, 4);
+		bits.writeBytes(data, chunk);
+		data += chunk;
+		length -= chunk;
+	} while (length > 0);
+}
+
+// One non-final block holding symbols, or the raw bytes they encode if storing them is smaller
+void writeBlock(BitWriter& bits, const std::vector<LzSymbol>& symbols, const unsigned char* raw, size_t rawLength)
+{
+	std::array<std::uint32_t, literalLengthCodes> literalFrequencies{};
+	std::array<std::uint32_t, distanceCodes> distanceFrequencies{};
+	for (const LzSymbol& symbol : symbols)
+	{
+		if (symbol.distance == 0) {
+			++literalFrequencies[symbol.litLen];
+		}
+		else
+		{
+			++literalFrequencies[257 + lengthCodes[symbol.litLen]];
+			++distanceFrequencies[distanceCode(symbol.distance)];
+		}
+	}
+	++literalFrequencies[endOfBlock];
+
+	std::array<unsigned char, literalLengthCodes> literalLengths{};
+	std::array<unsigned char, distanceCodes> distanceLengths{};
+	huffmanLengths(literalFrequencies.data(), literalLengthCodes, 15, literalLengths.data());
+	huffmanLengths(distanceFrequencies.data(), distanceCodes, 15, distanceLengths.data());
+	if (std::all_of(distanceLengths.begin(), distanceLengths.end(), [](unsigned char length) { return length == 0; })) {
+		// At least one distance code must be described, even if unused
+		distanceLengths[0] = 1;
+	}
+
+	int literalCount = literalLengthCodes;
+	while (literalCount > 257 && literalLengths[literalCount - 1] == 0) {
+		--literalCount;
+	}
+	int distanceCount = distanceCodes;
+	while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0) {
+		--distanceCount;
+	}
+
+	// Literal and distance lengths are sent as one run-length coded sequence
+	std::array<unsigned char, literalLengthCodes + distanceCodes> lengths{};
+	std::copy(literalLengths.begin(), literalLengths.begin() + literalCount, lengths.begin());
+	std::copy(distanceLengths.begin(), distanceLengths.begin() + distanceCount, lengths.begin() + literalCount);
+	int total = literalCount + distanceCount;
+	std::vector<std::pair<int, int>> runs;   // (code-length symbol, extra bits value)
+	for (int i = 0; i < total;)
+	{
+		int length = lengths[i];
+		int run = 1;
+		while (i + run < total && lengths[i + run] == length) {
+			++run;
+		}
+		i += run;
+		if (length == 0)
+		{
+			for (; run >= 11; run -= std::min(run, 138)) {
+				runs.emplace_back(18, std::min(run, 138) - 11);
+			}
+			if (run >= 3)
+			{
+				runs.emplace_back(17, run - 3);
+				run = 0;
+			}
+		}
+		else
+		{
+			runs.emplace_back(length, 0);
+			for (--run; run >= 3; run -= std::min(run, 6)) {
+				runs.emplace_back(16, std::min(run, 6) - 3);
+			}
+		}
+		for (; run > 0; --run) {
+			runs.emplace_back(length, 0);
+		}
+	}
+
+	std::array<std::uint32_t, 19> codeLengthFrequencies{};
+	for (const auto& run : runs) {
+		++codeLengthFrequencies[run.first];
+	}
+	std::array<unsigned char, 19> codeLengthLengths{};
+	huffmanLengths(codeLengthFrequencies.data(), 19, 7, codeLengthLengths.data());
+	int codeLengthCount = 19;
+	while (codeLengthCount > 4 && codeLengthLengths[codeLengthOrder[codeLengthCount - 1]] == 0) {
+		--codeLengthCount;
+	}
+
+	constexpr std::array<int, 19> runExtraBits{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+	std::uint64_t dynamicBits = 3 + 14 + 3 * static_cast<std::uint64_t>(codeLengthCount);
+	for (int i = 0; i < 19; ++i) {
+		dynamicBits += static_cast<std::uint64_t>(codeLengthFrequencies[i]) * (codeLengthLengths[i] + runExtraBits[i]);
+	}
+	for (int i = 0; i < literalLengthCodes; ++i) {
+		dynamicBits += static_cast<std::uint64_t>(literalFrequencies[i]) * (literalLengths[i] + (i > 256 ? lengthExtraBits[i - 257] : 0));
+	}
+	for (int i = 0; i < distanceCodes; ++i) {
+		dynamicBits += static_cast<std::uint64_t>(distanceFrequencies[i]) * (distanceLengths[i] + distanceExtraBits[i]);
+	}
+	std::uint64_t storedBits = (rawLength / 65535 + 1) * (3 + 7 + 32) + static_cast<std::uint64_t>(rawLength) * 8;
+	if (storedBits <= dynamicBits)
+	{
+		writeStoredBlocks(bits, raw, rawLength);
+		return;
+	}
+
+	std::array<std::uint16_t, literalLengthCodes> literalCodes{};
+	std::array<std::uint16_t, distanceCodes> distanceCodeBits{};
+	std::array<std::uint16_t, 19> codeLengthCodes{};
+	canonicalCodes(literalLengths.data(), literalLengthCodes, literalCodes.data());
+	canonicalCodes(distanceLengths.data(), distanceCodes, distanceCodeBits.data());
+	canonicalCodes(codeLengthLengths.data(), 19, codeLengthCodes.data());
+
+	bits.write(2 << 1, 3);   // BFINAL = 0, BTYPE = 10 (dynamic Huffman)
+	bits.write(static_cast<std::uint32_t>(literalCount - 257), 5);
+	bits.write(static_cast<std::uint32_t>(distanceCount - 1), 5);
+	bits.write(static_cast<std::uint32_t>(codeLengthCount - 4), 4);
+	for (int i = 0; i < codeLengthCount; ++i) {
+		bits.write(codeLengthLengths[codeLengthOrder[i]], 3);
+	}
+	for (const auto& [symbol, extra] : runs)
+	{
+		bits.write(codeLengthCodes[symbol], codeLengthLengths[symbol]);
+		if (runExtraBits[symbol] != 0) {
+			bits.write(static_cast<std::uint32_t>(extra), runExtraBits[symbol]);
+		}
+	}
+	for (const LzSymbol& symbol : symbols)
+	{
+		if (symbol.distance == 0)
+		{
+			bits.write(literalCodes[symbol.litLen], literalLengths[symbol.litLen]);
+			continue;
+		}
+		int lengthCode = lengthCodes[symbol.litLen];
+		bits.write(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+		bits.write(static_cast<std::uint32_t>(symbol.litLen - lengthBase[lengthCode]), lengthExtraBits[lengthCode]);
+		int code = distanceCode(symbol.distance);
+		bits.write(distanceCodeBits[code], distanceLengths[code]);
+		bits.write(static_cast<std::uint32_t>(symbol.distance - distanceBase[code]), distanceExtraBits[code]);
+	}
+	bits.write(literalCodes[endOfBlock], literalLengths[endOfBlock]);
+}
+
+struct DeflateLevel
+{
+	int maxChain{};
+	int niceLength{};
+	bool lazy{};
+};
+
+constexpr std::array<DeflateLevel, 10> deflateLevels{ {
+	{ 0, 0, false }, { 4, 16, false }, { 8, 32, false }, { 16, 64, false }, { 16, 32, true },
+	{ 32, 64, true }, { 64, 128, true }, { 128, 128, true }, { 512, 258, true }, { 2048, 258, true }
+} };
+
+constexpr size_t symbolsPerBlock{ 16384 };
+
+// Compresses data[begin, end) into out as non-final blocks followed by a sync flush, so out ends
+// byte-aligned. Matches may reach back into the 32 KiB before begin.
+void deflateStripe(const unsigned char* data, size_t begin, size_t end, int level, std::vector<unsigned char>& out)
+{
+	BitWriter bits(out);
+	if (level <= 0)
+	{
+		writeStoredBlocks(bits, data + begin, end - begin);
+	}
+	else
+	{
+		const DeflateLevel& params = deflateLevels[std::min(level, 9)];
+		constexpr int hashBits = 15;
+		size_t origin = begin > deflateWindow ? begin - deflateWindow : 0;
+		std::vector<std::int32_t> head(size_t{ 1 } << hashBits, -1);
+		std::vector<std::int32_t> previous(end - origin, -1);
+
+		auto hash = [&](size_t p)
+		{
+			return ((static_cast<std::uint32_t>(data[p]) << 10) ^ (static_cast<std::uint32_t>(data[p + 1]) << 5) ^ data[p + 2]) & ((1u << hashBits) - 1);
+		};
+		auto insert = [&](size_t p)
+		{
+			if (p + minMatchLength <= end)
+			{
+				std::uint32_t h = hash(p);
+				previous[p - origin] = head[h];
+				head[h] = static_cast<std::int32_t>(p - origin);
+			}
+		};
+		// Longest earlier match at p as (length, distance); length < 3 means none
+		auto findMatch = [&](size_t p)
+		{
+			std::pair<int, int> best{ 0, 0 };
+			int limit = static_cast<int>(std::min<size_t>(maxMatchLength, end - p));
+			if (limit < minMatchLength) {
+				return best;
+			}
+			best.first = minMatchLength - 1;
+			std::int32_t candidate = head[hash(p)];
+			for (int chain = params.maxChain; candidate >= 0 && chain > 0; --chain)
+			{
+				size_t c = origin + static_cast<size_t>(candidate);
+				if (p - c > deflateWindow) {
+					break;
+				}
+				if (data[c + best.first] == data[p + best.first])
+				{
+					int length = 0;
+					while (length < limit && data[c + length] == data[p + length]) {
+						++length;
+					}
+					if (length > best.first)
+					{
+						best = { length, static_cast<int>(p - c) };
+						if (length >= std::min(limit, params.niceLength)) {
+							break;
+						}
+					}
+				}
+				candidate = previous[candidate];
+			}
+			if (best.second == 0) {
+				best.first = 0;
+			}
+			return best;
+		};
+
+		for (size_t p = origin; p < begin; ++p) {
+			insert(p);
+		}
+
+		std::vector<LzSymbol> symbols;
+		symbols.reserve(symbolsPerBlock + 2);
+		size_t blockStart = begin;
+		size_t p = begin;
+		while (p < end)
+		{
+			std::pair<int, int> match = findMatch(p);
+			insert(p);
+			// Lazy evaluation: emit a literal instead when the next position matches longer
+			while (params.lazy && match.first >= minMatchLength && match.first < params.niceLength && p + 1 < end)
+			{
+				std::pair<int, int> nextMatch = findMatch(p + 1);
+				if (nextMatch.first <= match.first) {
+					break;
+				}
+				symbols.push_back({ data[p], 0 });
+				insert(++p);
+				match = nextMatch;
+			}
+			if (match.first >= minMatchLength)
+			{
+				symbols.push_back({ static_cast<std::uint16_t>(match.first), static_cast<std::uint16_t>(match.second) });
+				for (size_t q = p + 1; q < p + match.first; ++q) {
+					insert(q);
+				}
+				p += match.first;
+			}
+			else
+			{
+				symbols.push_back({ data[p], 0 });
+				++p;
+			}
+			if (symbols.size() >= symbolsPerBlock || p >= end)
+			{
+				writeBlock(bits, symbols, data + blockStart, p - blockStart);
+				symbols.clear();
+				blockStart = p;
+			}
+		}
+	}
+	// Sync flush: an empty stored block leaves the stream byte-aligned
+	static constexpr unsigned char syncMarker[4] = { 0x00, 0x00, 0xFF, 0xFF };
+	bits.write(0, 3);
+	bits.alignToByte();
+	bits.writeBytes(syncMarker, 4);
+}
+
+constexpr std::uint32_t adlerModulus{ 65521 };
+
+std::uint32_t adler32(const unsigned char* data, size_t length, std::uint32_t adler = 1)
+{
+	std::uint32_t a = adler & 0xFFFF;
+	std::uint32_t b = adler >> 16;
+	while (length > 0)
+	{
+		// 5552 is the most bytes that can be summed before b can overflow 32 bits
+		size_t chunk = std::min<size_t>(length, 5552);
+		for (size_t i = 0; i < chunk; ++i)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= adlerModulus;
+		b %= adlerModulus;
+		data += chunk;
+		length -= chunk;
+	}
+	return (b << 16) | a;
+}
+
+// Adler-32 of two concatenated buffers from the checksum of each (zlib's adler32_combine)
+std::uint32_t adler32Combine(std::uint32_t first, std::uint32_t second, size_t secondLength)
+{
+	std::uint32_t remainder = static_cast<std::uint32_t>(secondLength % adlerModulus);
+	std::uint32_t sum1 = first & 0xFFFF;
+	std::uint32_t sum2 = static_cast<std::uint32_t>((static_cast<std::uint64_t>(remainder) * sum1) % adlerModulus);
+	sum1 += (second & 0xFFFF) + adlerModulus - 1;
+	sum2 += ((first >> 16) & 0xFFFF) + ((second >> 16) & 0xFFFF) + adlerModulus - remainder;
+	if (sum1 >= adlerModulus) sum1 -= adlerModulus;
+	if (sum1 >= adlerModulus) sum1 -= adlerModulus;
+	if (sum2 >= adlerModulus << 1) sum2 -= adlerModulus << 1;
+	if (sum2 >= adlerModulus) sum2 -= adlerModulus;
+	return sum1 | (sum2 << 16);
+}
+
+constexpr unsigned char zlibHeaderFlags(int level)
+{
+	// FLEVEL hint; each value keeps (CMF * 256 + FLG) a multiple of 31 with CMF = 0x78
+	return level <= 1 ? 0x01 : level <= 5 ? 0x5E : level == 6 ? 0x9C : 0xDA;
+}
+
+// Scanline filters
+// --------------------------------------------------------------------------------
+
+constexpr unsigned char paethPredictor(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = p > a ? p - a : a - p;
+	int pb = p > b ? p - b : b - p;
+	int pc = p > c ? p - c : c - p;
+	return static_cast<unsigned char>(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// Writes filter type `type` (1-4, or 0 for none) of row into out; previous is null for the first row
+void filterScanline(int type, const unsigned char* row, const unsigned char* previous, size_t length, int bytesPerPixel, unsigned char* out)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		int left = i >= static_cast<size_t>(bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+		int up = previous ? previous[i] : 0;
+		int upLeft = previous && i >= static_cast<size_t>(bytesPerPixel) ? previous[i - bytesPerPixel] : 0;
+		int prediction = 0;
+		switch (type)
+		{
+		case 1: prediction = left; break;
+		case 2: prediction = up; break;
+		case 3: prediction = (left + up) >> 1; break;
+		case 4: prediction = paethPredictor(left, up, upLeft); break;
+		default: break;
+		}
+		out[i] = static_cast<unsigned char>(row[i] - prediction);
+	}
+}
+
+// Writes the filter type byte and the filtered row to line; trial is scratch of length bytes for Adaptive
+void filterRow(PngFilter filter, const unsigned char* row, const unsigned char* previous, size_t length, int bytesPerPixel, unsigned char* line, unsigned char* trial)
+{
+	if (filter != PngFilter::Adaptive)
+	{
+		line[0] = static_cast<unsigned char>(filter);
+		filterScanline(line[0], row, previous, length, bytesPerPixel, line + 1);
+		return;
+	}
+	std::uint64_t bestScore = ~std::uint64_t{ 0 };
+	for (int type = 0; type < 5; ++type)
+	{
+		filterScanline(type, row, previous, length, bytesPerPixel, trial);
+		std::uint64_t score = 0;
+		for (size_t i = 0; i < length; ++i) {
+			score += trial[i] < 128 ? trial[i] : 256 - trial[i];
+		}
+		if (score < bestScore)
+		{
+			bestScore = score;
+			line[0] = static_cast<unsigned char>(type);
+			std::memcpy(line + 1, trial, length);
+		}
+	}
+}
+
+// Scanline compression
+// --------------------------------------------------------------------------------
+
+// Filters scanlines and deflates them into a zlib stream a batch at a time. A batch is one stripe
+// of options.stripeRows per worker; its stripes are compressed concurrently, each primed with the
+// 32 KiB of filtered data before it. Only the batch, that window and the last raw row are held.
+class ScanlineCompressor
+{
+
+private:
+	size_t lineBytes{};
+	int bytesPerPixel{};
+	PngOptions options{};
+	int stripeRows{};
+	std::vector<unsigned char> previousRow{};
+	// Deflate window (already compressed) followed by the filtered rows of the pending batch
+	std::vector<unsigned char> filtered{};
+	size_t windowBytes{};
+	int pendingRows{};
+	std::uint32_t checksum{ 1 };
+	bool started{};
+
+public:
+	ScanlineCompressor(size_t lineBytes, int bytesPerPixel, const PngOptions& options);
+
+	// Rows that fill a batch; compress() is most efficient with exactly this many pending
+	int batchRows() const { return stripeRows * workerCount(); }
+	int pending() const { return pendingRows; }
+
+	// Filters count rows (lineBytes each) into the pending batch
+	void addRows(const unsigned char* const* rows, int count);
+
+	// zlib bytes for the pending rows, preceded by the stream header the first time; last also
+	// terminates the stream
+	std::vector<unsigned char> compress(bool last);
+};
+
+ScanlineCompressor::ScanlineCompressor(size_t lineBytes, int bytesPerPixel, const PngOptions& options)
+	: lineBytes{ lineBytes }, bytesPerPixel{ bytesPerPixel }, options{ options }
+{
+	if (options.level < 0 || options.level > 9 || options.stripeRows < 0) {
+		throw std::invalid_argument("Invalid PNG options");
+	}
+	constexpr size_t targetStripeBytes{ 128 * 1024 };
+	size_t filteredLine = lineBytes + 1;
+	stripeRows = options.stripeRows > 0 ? options.stripeRows : static_cast<int>(std::max<size_t>(1, (targetStripeBytes + filteredLine - 1) / filteredLine));
+}
+
+void ScanlineCompressor::addRows(const unsigned char* const* rows, int count)
+{
+	if (count <= 0) {
+		return;
+	}
+	size_t filteredLine = lineBytes + 1;
+	size_t start = filtered.size();
+	filtered.resize(start + filteredLine * count);
+	const unsigned char* before = previousRow.empty() ? nullptr : previousRow.data();
+	parallelRows(count, [&](int y0, int y1)
+	{
+		std::vector<unsigned char> trial(options.filter == PngFilter::Adaptive ? lineBytes : 0);
+		for (int y = y0; y < y1; ++y) {
+			filterRow(options.filter, rows[y], y > 0 ? rows[y - 1] : before, lineBytes, bytesPerPixel, filtered.data() + start + static_cast<size_t>(y) * filteredLine, trial.data());
+		}
+	});
+	previousRow.assign(rows[count - 1], rows[count - 1] + lineBytes);
+	pendingRows += count;
+}
+
+std::vector<unsigned char> ScanlineCompressor::compress(bool last)
+{
+	size_t stripeBytes = static_cast<size_t>(stripeRows) * (lineBytes + 1);
+	std::vector<size_t> stripeEnds;
+	for (size_t end = windowBytes + stripeBytes; end < filtered.size(); end += stripeBytes) {
+		stripeEnds.push_back(end);
+	}
+	if (filtered.size() > windowBytes) {
+		stripeEnds.push_back(filtered.size());
+	}
+
+	int stripeCount = static_cast<int>(stripeEnds.size());
+	std::vector<std::vector<unsigned char>> compressed(stripeCount);
+	std::vector<std::uint32_t> checksums(stripeCount);
+	std::atomic<int> nextStripe{ 0 };
+	parallelFor(std::min(stripeCount, workerCount()), [&](int)
+	{
+		for (int stripe = nextStripe++; stripe < stripeCount; stripe = nextStripe++)
+		{
+			size_t begin = stripe == 0 ? windowBytes : stripeEnds[stripe - 1];
+			deflateStripe(filtered.data(), begin, stripeEnds[stripe], options.level, compressed[stripe]);
+			checksums[stripe] = adler32(filtered.data() + begin, stripeEnds[stripe] - begin);
+		}
+	});
+
+	std::vector<unsigned char> stream;
+	if (!started)
+	{
+		stream = { 0x78, zlibHeaderFlags(options.level) };
+		started = true;
+	}
+	for (int stripe = 0; stripe < stripeCount; ++stripe)
+	{
+		stream.insert(stream.end(), compressed[stripe].begin(), compressed[stripe].end());
+		size_t begin = stripe == 0 ? windowBytes : stripeEnds[stripe - 1];
+		checksum = adler32Combine(checksum, checksums[stripe], stripeEnds[stripe] - begin);
+	}
+	if (last)
+	{
+		// Final empty block with fixed codes: BFINAL = 1, BTYPE = 01, end-of-block code 0000000
+		stream.push_back(0x03);
+		stream.push_back(0x00);
+		appendBigEndian(stream, checksum);
+	}
+
+	// Keep only the window the next batch may reference
+	windowBytes = std::min<size_t>(filtered.size(), deflateWindow);
+	filtered.erase(filtered.begin(), filtered.end() - windowBytes);
+	pendingRows = 0;
+	return stream;
+}
+
+// IDAT payload of height rows, stride bytes apart, compressed one batch at a time
+std::vector<unsigned char> compressScanlines(const unsigned char* rows, size_t stride, size_t lineBytes, int height, int bytesPerPixel, const PngOptions& options)
+{
+	ScanlineCompressor compressor(lineBytes, bytesPerPixel, options);
+	std::vector<const unsigned char*> rowPointers(height);
+	for (int y = 0; y < height; ++y) {
+		rowPointers[y] = rows + static_cast<size_t>(y) * stride;
+	}
+	std::vector<unsigned char> data;
+	for (int y = 0; y < height; y += compressor.batchRows())
+	{
+		compressor.addRows(rowPointers.data() + y, std::min(compressor.batchRows(), height - y));
+		std::vector<unsigned char> part = compressor.compress(y + compressor.batchRows() >= height);
+		data.insert(data.end(), part.begin(), part.end());
+	}
+	return data;
+}
+
+// Encoders
+// --------------------------------------------------------------------------------
+
+// Writes an 8-bit grey, grey + alpha, RGB or RGBA PNG (channels 1-4) to a sink as its rows arrive.
+// Each compressed batch leaves as its own IDAT chunk, so memory stays at a batch of rows no matter
+// how tall the image is.
+class PngStreamEncoder
+{
+
+public:
+	using Sink = std::function<void(const unsigned char*, size_t)>;
+
+private:
+	int width{};
+	int height{};
+	int channels{};
+	Sink sink{};
+	ScanlineCompressor compressor;
+	int rowsWritten{};
+	bool finished{};
+
+	void writeData(const std::vector<unsigned char>& data);
+
+public:
+	PngStreamEncoder(int width, int height, int channels, Sink sink, const PngOptions& options = {});
+
+	// Rows to supply per writeRows call to keep every worker busy
+	int batchRows() const { return compressor.batchRows(); }
+
+	// Appends the next count rows, width * channels bytes each
+	void writeRows(const unsigned char* const* rows, int count);
+
+	// Writes the end of the stream; every row must have been written
+	void finish();
+};
+
+PngStreamEncoder::PngStreamEncoder(int width, int height, int channels, Sink sink, const PngOptions& options)
+	: width{ width }, height{ height }, channels{ channels }, sink{ std::move(sink) },
+	  compressor{ static_cast<size_t>(std::max(width, 0)) * std::clamp(channels, 1, 4), std::clamp(channels, 1, 4), options }
+{
+	static constexpr unsigned char colorTypes[5] = { 0, 0, 4, 2, 6 };
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		throw std::invalid_argument("Invalid PNG parameters");
+	}
+	std::vector<unsigned char> header;
+	appendPngSignature(header);
+	appendPngHeader(header, width, height, colorTypes[channels]);
+	this->sink(header.data(), header.size());
+}
+
+void PngStreamEncoder::writeData(const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> chunk;
+	chunk.reserve(data.size() + 12);
+	appendPngChunk(chunk, "IDAT", data.data(), data.size());
+	sink(chunk.data(), chunk.size());
+}
+
+void PngStreamEncoder::writeRows(const unsigned char* const* rows, int count)
+{
+	if (finished || count < 0 || count > height - rowsWritten) {
+		throw std::invalid_argument("More PNG rows than the image height");
+	}
+	while (count > 0)
+	{
+		int take = std::min(count, batchRows() - compressor.pending());
+		compressor.addRows(rows, take);
+		rows += take;
+		count -= take;
+		rowsWritten += take;
+		if (compressor.pending() == batchRows() && rowsWritten < height) {
+			writeData(compressor.compress(false));
+		}
+	}
+}
+
+void PngStreamEncoder::finish()
+{
+	if (finished) {
+		return;
+	}
+	if (rowsWritten != height) {
+		throw std::runtime_error("PNG stream finished before all rows were written");
+	}
+	writeData(compressor.compress(true));
+	std::vector<unsigned char> end;
+	appendPngChunk(end, "IEND", nullptr, 0);
+	sink(end.data(), end.size());
+	finished = true;
+}
+
+// Encodes 8-bit grey, grey + alpha, RGB or RGBA rows (channels 1-4), stride bytes apart
+std::vector<unsigned char> encodePng(const unsigned char* rows, size_t stride, int width, int height, int channels, const PngOptions& options = {})
+{
+	std::vector<unsigned char> png;
+	PngStreamEncoder encoder(width, height, channels, [&png](const unsigned char* data, size_t length)
+	{
+		png.insert(png.end(), data, data + length);
+	}, options);
+	std::vector<const unsigned char*> rowPointers(height);
+	for (int y = 0; y < height; ++y) {
+		rowPointers[y] = rows + static_cast<size_t>(y) * stride;
+	}
+	encoder.writeRows(rowPointers.data(), height);
+	encoder.finish();
+	return png;
+}
+
+// Fills band with rowCount tightly packed rows starting at firstRow
+using PngRowProducer = std::function<void(int firstRow, int rowCount, unsigned char* band)>;
+
+// Encodes a PNG whose rows are pulled from producer one batch at a time and written to sink as they
+// are compressed; only one batch of rows is ever resident
+void encodePngStream(int width, int height, int channels, const PngRowProducer& producer, PngStreamEncoder::Sink sink, const PngOptions& options = {})
+{
+	PngStreamEncoder encoder(width, height, channels, std::move(sink), options);
+	size_t lineBytes = static_cast<size_t>(width) * channels;
+	int bandRows = std::min(encoder.batchRows(), height);
+	std::vector<unsigned char> band(lineBytes * bandRows);
+	std::vector<const unsigned char*> rowPointers(bandRows);
+	for (int y = 0; y < bandRows; ++y) {
+		rowPointers[y] = band.data() + static_cast<size_t>(y) * lineBytes;
+	}
+	for (int y = 0; y < height; y += bandRows)
+	{
+		int count = std::min(bandRows, height - y);
+		producer(y, count, band.data());
+		encoder.writeRows(rowPointers.data(), count);
+	}
+	encoder.finish();
+}
+
+// Encodes one palette index per pixel (rows tightly packed) as a colour-type 3 PNG.
+// The palette is RGBA; a tRNS chunk is only written when some entry is not opaque.
+std::vector<unsigned char> encodeIndexedPng(const unsigned char* indices, int width, int height, const unsigned char* paletteRGBA, int colors, const PngOptions& options = {})
+{
+	if (width <= 0 || height <= 0 || colors <= 0 || colors > 256) {
+		throw std::invalid_argument("Invalid indexed PNG parameters");
+	}
+
+	// Palette indices are not magnitudes, so prediction rarely helps them
+	PngOptions indexedOptions = options;
+	if (indexedOptions.filter == PngFilter::Adaptive) {
+		indexedOptions.filter = PngFilter::None;
+	}
+	std::vector<unsigned char> data = compressScanlines(indices, width, width, height, 1, indexedOptions);
+
+	std::vector<unsigned char> palette;
+	std::vector<unsigned char> alpha;
+	bool translucent = false;
+	for (int i = 0; i < colors; ++i)
+	{
+		palette.insert(palette.end(), paletteRGBA + i * 4, paletteRGBA + i * 4 + 3);
+		alpha.push_back(paletteRGBA[i * 4 + 3]);
+		translucent = translucent || paletteRGBA[i * 4 + 3] != 255;
+	}
+
+	std::vector<unsigned char> png;
+	appendPngSignature(png);
+	appendPngHeader(png, width, height, 3);
+	appendPngChunk(png, "PLTE", palette.data(), palette.size());
+	if (translucent) {
+		appendPngChunk(png, "tRNS", alpha.data(), alpha.size());
+	}
+	appendPngChunk(png, "IDAT", data.data(), data.size());
+	appendPngChunk(png, "IEND", nullptr, 0);
+	return png;
+}
+
+// Encodes interleaved 16-bit RGBA samples (rows tightly packed) as a colour-type 6, 16-bit PNG
+std::vector<unsigned char> encodeRgba16Png(const std::uint16_t* samples, int width, int height, const PngOptions& options = {})
+{
+	if (width <= 0 || height <= 0) {
+		throw std::invalid_argument("Invalid PNG parameters");
+	}
+
+	// PNG stores 16-bit samples big-endian
+	size_t lineBytes = static_cast<size_t>(width) * 8;
+	std::vector<unsigned char> rows(lineBytes * height);
+	for (size_t i = 0; i < rows.size() / 2; ++i)
+	{
+		rows[2 * i] = static_cast<unsigned char>(samples[i] >> 8);
+		rows[2 * i + 1] = static_cast<unsigned char>(samples[i]);
+	}
+	std::vector<unsigned char> data = compressScanlines(rows.data(), lineBytes, lineBytes, height, 8, options);
+
+	std::vector<unsigned char> png;
+	appendPngSignature(png);
+	appendPngHeader(png, width, height, 6, 16);
+	appendPngChunk(png, "IDAT", data.data(), data.size());
+	appendPngChunk(png, "IEND", nullptr, 0);
+	return png;
+}
@@ -0,0 +1,428 @@
+#pragma once
+
+#include "Parallel.h"
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// Native tiled container for cached intermediates. The image is cut into square RGBA tiles, each
+// compressed on its own with an LZ4 block codec, and an index of tile offsets follows the header,
+// so any region can be read by decompressing only the tiles that overlap it.
+//
+// Layout (all integers little-endian):
+//   "ITIL", version, width, height, tileSize, channels      six 32-bit fields, 24 bytes
+//   one index entry per tile, row-major:                    64-bit offset, 32-bit size, 32-bit encoding,
+//                                                           32-bit Adler-32 of the uncompressed tile
+//   tile data, each tile's rows tightly packed (edge tiles are clipped to the image)
+
+constexpr int defaultTileSize{ 256 };
+// Keeps every tile's byte count within the 32-bit index field
+constexpr int maxTileSize{ 16384 };
+constexpr std::uint32_t tiledVersion{ 2 };
+constexpr size_t tiledHeaderBytes{ 24 };
+constexpr size_t tileIndexEntryBytes{ 20 };
+
+enum class TileEncoding : std::uint32_t { Stored = 0, LZ4 = 1 };
+
+// LZ4 block codec
+// --------------------------------------------------------------------------------
+// The LZ4 block format: sequences of a token (literal count, match length - 4), literals and a
+// 16-bit match offset. A greedy single-probe hash matcher keeps compression at memory speed; the
+// decoder is a bounds-checked copy loop.
+
+constexpr int lz4MinMatch{ 4 };
+// The last match must start this far before the end, and the last 5 bytes are always literals
+constexpr size_t lz4MatchStartLimit{ 12 };
+constexpr size_t lz4LastLiterals{ 5 };
+constexpr size_t lz4MaxOffset{ 65535 };
+
+std::uint32_t load32(const unsigned char* p)
+{
+	std::uint32_t value;
+	std::memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+// Appends a length of 15 or more as the 255-byte continuation run that follows its token nibble
+void appendLz4Length(std::vector<unsigned char>& out, size_t length)
+{
+	for (length -= 15; length >= 255; length -= 255) {
+		out.push_back(255);
+	}
+	out.push_back(static_cast<unsigned char>(length));
+}
+
+void appendLz4Sequence(std::vector<unsigned char>& out, const unsigned char* literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+	size_t matchCode = matchLength - lz4MinMatch;
+	out.push_back(static_cast<unsigned char>((std::min<size_t>(literalCount, 15) << 4) | (offset != 0 ? std::min<size_t>(matchCode, 15) : 0)));
+	if (literalCount >= 15) {
+		appendLz4Length(out, literalCount);
+	}
+	out.insert(out.end(), literals, literals + literalCount);
+	// The final sequence is literals only
+	if (offset == 0) {
+		return;
+	}
+	out.push_back(static_cast<unsigned char>(offset));
+	out.push_back(static_cast<unsigned char>(offset >> 8));
+	if (matchCode >= 15) {
+		appendLz4Length(out, matchCode);
+	}
+}
+
+std::vector<unsigned char> lz4Compress(const unsigned char* data, size_t length)
+{
+	std::vector<unsigned char> out;
+	out.reserve(length + length / 255 + 16);
+	size_t anchor = 0;
+	if (length > lz4MatchStartLimit + lz4MinMatch)
+	{
+		constexpr int hashBits = 14;
+		std::vector<std::uint32_t> table(size_t{ 1 } << hashBits, 0);
+		auto hash = [](std::uint32_t sequence) { return (sequence * 2654435761u) >> (32 - hashBits); };
+
+		size_t matchStartEnd = length - lz4MatchStartLimit;
+		size_t matchEnd = length - lz4LastLiterals;
+		size_t p = 1;
+		table[hash(load32(data))] = 0;
+		// Skip faster through data that keeps missing, as LZ4 does for incompressible input
+		size_t misses = 0;
+		while (p < matchStartEnd)
+		{
+			std::uint32_t sequence = load32(data + p);
+			std::uint32_t& slot = table[hash(sequence)];
+			size_t candidate = slot;
+			slot = static_cast<std::uint32_t>(p);
+			if (p - candidate > lz4MaxOffset || load32(data + candidate) != sequence)
+			{
+				p += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+			while (p > anchor && candidate > 0 && data[p - 1] == data[candidate - 1])
+			{
+				--p;
+				--candidate;
+			}
+			size_t matchLength = lz4MinMatch;
+			while (p + matchLength < matchEnd && data[p + matchLength] == data[candidate + matchLength]) {
+				++matchLength;
+			}
+			appendLz4Sequence(out, data + anchor, p - anchor, p - candidate, matchLength);
+			p += matchLength;
+			anchor = p;
+			if (p < matchStartEnd) {
+				table[hash(load32(data + p - 2))] = static_cast<std::uint32_t>(p - 2);
+			}
+		}
+	}
+	appendLz4Sequence(out, data + anchor, length - anchor, 0, lz4MinMatch);
+	return out;
+}
+
+// Decodes a block into exactly length bytes at out; throws on malformed or mis-sized input
+void lz4Decompress(const unsigned char* data, size_t size, unsigned char* out, size_t length)
+{
+	const unsigned char* end = data + size;
+	size_t written = 0;
+	auto corrupt = []() { throw std::runtime_error("Corrupt tile data"); };
+	auto readLength = [&](size_t nibble)
+	{
+		if (nibble != 15) {
+			return nibble;
+		}
+		unsigned char extra = 255;
+		while (extra == 255)
+		{
+			if (data == end) {
+				corrupt();
+			}
+			extra = *data++;
+			nibble += extra;
+		}
+		return nibble;
+	};
+
+	while (true)
+	{
+		if (data == end) {
+			corrupt();
+		}
+		unsigned char token = *data++;
+		size_t literalCount = readLength(token >> 4);
+		if (literalCount > static_cast<size_t>(end - data) || literalCount > length - written) {
+			corrupt();
+		}
+		std::memcpy(out + written, data, literalCount);
+		data += literalCount;
+		written += literalCount;
+		if (data == end) {
+			break;
+		}
+
+		if (end - data < 2) {
+			corrupt();
+		}
+		size_t offset = data[0] | static_cast<size_t>(data[1]) << 8;
+		data += 2;
+		size_t matchLength = readLength(token & 0x0F) + lz4MinMatch;
+		if (offset == 0 || offset > written || matchLength > length - written) {
+			corrupt();
+		}
+		unsigned char* target = out + written;
+		const unsigned char* source = target - offset;
+		if (offset >= matchLength) {
+			std::memcpy(target, source, matchLength);
+		}
+		else
+		{
+			// Overlapping copy repeats the last offset bytes
+			for (size_t i = 0; i < matchLength; ++i) {
+				target[i] = source[i];
+			}
+		}
+		written += matchLength;
+	}
+	if (written != length) {
+		corrupt();
+	}
+}
+
+// Container
+// --------------------------------------------------------------------------------
+
+void appendLittleEndian(std::vector<unsigned char>& out, std::uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i) {
+		out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+	}
+}
+
+std::uint64_t readLittleEndian(const unsigned char* p, int bytes)
+{
+	std::uint64_t value = 0;
+	for (int i = bytes - 1; i >= 0; --i) {
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+// Splits RGBA rows (width * 4 bytes each) into tileSize squares and compresses them in parallel;
+// tiles LZ4 cannot shrink are stored as they are. Each tile's checksum covers its raw pixels.
+std::vector<unsigned char> encodeTiledImage(const unsigned char* const* rows, int width, int height, int tileSize = defaultTileSize)
+{
+	constexpr int channels = 4;
+	if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize > maxTileSize) {
+		throw std::invalid_argument("Invalid tiled image parameters");
+	}
+	int columns = (width - 1) / tileSize + 1;
+	int tileRows = (height - 1) / tileSize + 1;
+	int tileCount = columns * tileRows;
+
+	std::vector<std::vector<unsigned char>> tiles(tileCount);
+	std::vector<TileEncoding> encodings(tileCount, TileEncoding::LZ4);
+	std::vector<std::uint32_t> checksums(tileCount);
+	std::atomic<int> nextTile{ 0 };
+	parallelFor(std::min(tileCount, workerCount()), [&](int)
+	{
+		std::vector<unsigned char> raw;
+		for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+		{
+			int x0 = (tile % columns) * tileSize;
+			int y0 = (tile / columns) * tileSize;
+			size_t lineBytes = static_cast<size_t>(std::min(tileSize, width - x0)) * channels;
+			int lines = std::min(tileSize, height - y0);
+			raw.resize(lineBytes * lines);
+			for (int y = 0; y < lines; ++y) {
+				std::memcpy(raw.data() + y * lineBytes, rows[y0 + y] + static_cast<size_t>(x0) * channels, lineBytes);
+			}
+			checksums[tile] = adler32(raw.data(), raw.size());
+			tiles[tile] = lz4Compress(raw.data(), raw.size());
+			if (tiles[tile].size() >= raw.size())
+			{
+				tiles[tile] = raw;
+				encodings[tile] = TileEncoding::Stored;
+			}
+		}
+	});
+
+	std::vector<unsigned char> out{ 'I', 'T', 'I', 'L' };
+	for (int value : { static_cast<int>(tiledVersion), width, height, tileSize, channels }) {
+		appendLittleEndian(out, static_cast<std::uint32_t>(value), 4);
+	}
+	std::uint64_t offset = tiledHeaderBytes + tileIndexEntryBytes * tileCount;
+	for (int tile = 0; tile < tileCount; ++tile)
+	{
+		appendLittleEndian(out, offset, 8);
+		appendLittleEndian(out, tiles[tile].size(), 4);
+		appendLittleEndian(out, static_cast<std::uint32_t>(encodings[tile]), 4);
+		appendLittleEndian(out, checksums[tile], 4);
+		offset += tiles[tile].size();
+	}
+	out.reserve(offset);
+	for (const std::vector<unsigned char>& tile : tiles) {
+		out.insert(out.end(), tile.begin(), tile.end());
+	}
+	return out;
+}
+
+struct TiledHeader
+{
+	int width{};
+	int height{};
+	int tileSize{};
+};
+
+// Parses and validates the 24-byte header alone, so a prefix of the file is enough
+TiledHeader readTiledHeader(std::span<const std::byte> buffer)
+{
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer.data());
+	if (buffer.size() < tiledHeaderBytes || std::memcmp(data, "ITIL", 4) != 0) {
+		throw std::runtime_error("Not a tiled image");
+	}
+	auto field = [&](size_t offset)
+	{
+		std::uint64_t value = readLittleEndian(data + offset, 4);
+		if (value > static_cast<std::uint64_t>(std::numeric_limits<int>::max())) {
+			throw std::runtime_error("Invalid tiled image header");
+		}
+		return static_cast<int>(value);
+	};
+	TiledHeader header{ field(8), field(12), field(16) };
+	if (field(4) != static_cast<int>(tiledVersion) || field(20) != 4 || header.width <= 0 || header.height <= 0
+		|| header.tileSize <= 0 || header.tileSize > maxTileSize) {
+		throw std::runtime_error("Unsupported tiled image header");
+	}
+	return header;
+}
+
+// Random access to a tiled container held in memory, typically a MappedFile. Only the tiles a
+// read overlaps are touched, so with a mapping only their pages are ever loaded.
+class TiledImageReader
+{
+
+private:
+	struct TileEntry
+	{
+		std::uint64_t offset{};
+		std::uint32_t size{};
+		TileEncoding encoding{};
+		std::uint32_t checksum{};
+	};
+
+	const unsigned char* data{};
+	size_t size{};
+	int width{};
+	int height{};
+	int tileSize{};
+	int columns{};
+	int tileRows{};
+	std::vector<TileEntry> index{};
+
+public:
+	// Validates the header and the whole tile index; throws if either is malformed or truncated
+	explicit TiledImageReader(std::span<const std::byte> buffer);
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getTileSize() const { return tileSize; }
+
+	// Decompresses the tiles overlapping (x, y, w, h), which must lie inside the image, in parallel
+	// and copies their RGBA pixels into rows[0, h), each holding w pixels. Throws if a tile fails
+	// to decode or its checksum does not match.
+	void readRegion(int x, int y, int w, int h, unsigned char* const* rows) const;
+};
+
+TiledImageReader::TiledImageReader(std::span<const std::byte> buffer)
+	: data{ reinterpret_cast<const unsigned char*>(buffer.data()) }, size{ buffer.size() }
+{
+	TiledHeader header = readTiledHeader(buffer);
+	width = header.width;
+	height = header.height;
+	tileSize = header.tileSize;
+	columns = (width - 1) / tileSize + 1;
+	tileRows = (height - 1) / tileSize + 1;
+	size_t tileCount = static_cast<size_t>(columns) * tileRows;
+	if ((size - tiledHeaderBytes) / tileIndexEntryBytes < tileCount) {
+		throw std::runtime_error("Truncated tiled image");
+	}
+
+	index.resize(tileCount);
+	for (size_t tile = 0; tile < tileCount; ++tile)
+	{
+		const unsigned char* entry = data + tiledHeaderBytes + tile * tileIndexEntryBytes;
+		TileEntry& target = index[tile];
+		target.offset = readLittleEndian(entry, 8);
+		target.size = static_cast<std::uint32_t>(readLittleEndian(entry + 8, 4));
+		target.encoding = static_cast<TileEncoding>(readLittleEndian(entry + 12, 4));
+		target.checksum = static_cast<std::uint32_t>(readLittleEndian(entry + 16, 4));
+		size_t rawBytes = static_cast<size_t>(std::min(tileSize, width - static_cast<int>(tile % columns) * tileSize))
+			* std::min(tileSize, height - static_cast<int>(tile / columns) * tileSize) * 4;
+		bool validEncoding = target.encoding == TileEncoding::LZ4 || (target.encoding == TileEncoding::Stored && target.size == rawBytes);
+		if (!validEncoding || target.offset > size || size - target.offset < target.size) {
+			throw std::runtime_error("Truncated tiled image");
+		}
+	}
+}
+
+void TiledImageReader::readRegion(int x, int y, int w, int h, unsigned char* const* rows) const
+{
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || w > width - x || h > height - y) {
+		throw std::invalid_argument("Region outside the tiled image");
+	}
+	int firstColumn = x / tileSize;
+	int lastColumn = (x + w - 1) / tileSize;
+	int firstRow = y / tileSize;
+	int regionColumns = lastColumn - firstColumn + 1;
+	int regionTiles = regionColumns * ((y + h - 1) / tileSize - firstRow + 1);
+
+	std::atomic<int> nextTile{ 0 };
+	parallelFor(std::min(regionTiles, workerCount()), [&](int)
+	{
+		std::vector<unsigned char> scratch;
+		for (int i = nextTile++; i < regionTiles; i = nextTile++)
+		{
+			int column = firstColumn + i % regionColumns;
+			int row = firstRow + i / regionColumns;
+			const TileEntry& entry = index[static_cast<size_t>(row) * columns + column];
+			int tileX = column * tileSize;
+			int tileY = row * tileSize;
+			int tileWidth = std::min(tileSize, width - tileX);
+			int tileHeight = std::min(tileSize, height - tileY);
+			size_t lineBytes = static_cast<size_t>(tileWidth) * 4;
+
+			const unsigned char* pixels = data + entry.offset;
+			size_t tileBytes = lineBytes * tileHeight;
+			if (entry.encoding == TileEncoding::LZ4)
+			{
+				scratch.resize(tileBytes);
+				lz4Decompress(pixels, entry.size, scratch.data(), scratch.size());
+				pixels = scratch.data();
+			}
+			if (adler32(pixels, tileBytes) != entry.checksum) {
+				throw std::runtime_error("Corrupt tile data");
+			}
+
+			// Copy the part of the tile that overlaps the region
+			int x0 = std::max(x, tileX);
+			int x1 = std::min(x + w, tileX + tileWidth);
+			int y0 = std::max(y, tileY);
+			int y1 = std::min(y + h, tileY + tileHeight);
+			for (int line = y0; line < y1; ++line)
+			{
+				std::memcpy(rows[line - y] + static_cast<size_t>(x0 - x) * 4,
+					pixels + (line - tileY) * lineBytes + static_cast<size_t>(x0 - tileX) * 4,
+					static_cast<size_t>(x1 - x0) * 4);
+			}
+		}
+	});
+}
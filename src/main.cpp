@@ -1,8 +1,12 @@
 #include "ImageData.h"
+#include "LayerStack.h"
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <stdexcept>
+#include <cmath>
 
 namespace fs = std::filesystem;
 
@@ -36,11 +40,59 @@ int main() {
         const std::string outputDir = baseDir + "/output";
         ensureOutputDir(outputDir);
 
+        // === Probe headers ===
+        for (const std::string& path : { inputDog, inputCat }) {
+            ImageInfo info = ImageData::probe(path.c_str());
+            std::cout << "Probed " << path << ": " << info.width << "x" << info.height << ", " << info.channels
+                      << " channel(s), " << info.bitDepth << "-bit\n";
+        }
+
         // === Load Images ===
         ImageData dog, cat;
         loadSafe(dog, inputDog);
         loadSafe(cat, inputCat);
 
+        // === In-memory encode / decode ===
+        {
+            std::vector<std::byte> jpeg = cat.encodeTo(ImageFormat::JPG, 80);
+            std::cout << "Encoded cat as JPG in memory: " << jpeg.size() << " bytes\n";
+            ImageData decoded;
+            decoded.loadFromMemory(jpeg);
+            saveSafe(decoded, outputDir + "/cat_memory_roundtrip.png");
+        }
+
+        // === Uncompressed interchange formats ===
+        {
+            const std::string pamPath = outputDir + "/dog_intermediate.pam";
+            dog.saveImage(pamPath.c_str(), ImageFormat::PAM);
+            cat.saveImage((outputDir + "/cat_intermediate.ppm").c_str(), ImageFormat::PPM);
+            cat.saveImage((outputDir + "/cat_intermediate.raw").c_str(), ImageFormat::Raw);
+            ImageData handoff;
+            loadSafe(handoff, pamPath);
+            loadSafe(handoff, outputDir + "/cat_intermediate.raw");
+            saveSafe(handoff, outputDir + "/cat_raw_roundtrip.png");
+
+            // Tiled cache: a crop decompresses only the tiles it overlaps
+            const std::string tiledPath = outputDir + "/dog_cache.til";
+            dog.saveImage(tiledPath.c_str(), ImageFormat::Tiled);
+            ImageData region;
+            region.loadRegion(tiledPath.c_str(), { 100, 150, 300, 200 });
+            saveSafe(region, outputDir + "/dog_tiled_region.png");
+        }
+
+        // === Histograms ===
+        {
+            for (const auto& [name, img] : { std::pair<const char*, const ImageData&>{ "dog", dog }, { "cat", cat } }) {
+                Histogram lumaHistogram = img.histogram(HistogramChannel::Luma);
+                double sum = 0.0, count = 0.0;
+                for (int i = 0; i < 256; ++i) {
+                    sum += static_cast<double>(i) * lumaHistogram[i];
+                    count += lumaHistogram[i];
+                }
+                std::cout << "Mean luma (" << name << "): " << (count > 0 ? sum / count : 0.0) << "\n";
+            }
+        }
+
         // === Tone / Monochrome ===
         {
             ImageData d = dog, c = cat;
@@ -51,9 +103,24 @@ int main() {
             d.grayscale(); saveSafe(d, outputDir + "/dog_grayscale.png");
             c.grayscale(); saveSafe(c, outputDir + "/cat_grayscale.png");
 
+            d = dog; c = cat;
+            d.equalizeHistogram(); saveSafe(d, outputDir + "/dog_equalize.png");
+            c.clahe(8, 8, 2.0f); saveSafe(c, outputDir + "/cat_clahe.png");
+
             d = dog; c = cat;
             d.threshold(128); saveSafe(d, outputDir + "/dog_threshold.png");
             c.threshold(128); saveSafe(c, outputDir + "/cat_threshold.png");
+
+            d = dog; c = cat;
+            unsigned char otsu = d.thresholdOtsu(); saveSafe(d, outputDir + "/dog_otsu.png");
+            std::cout << "Otsu threshold (dog): " << static_cast<int>(otsu) << "\n";
+            c.adaptiveThreshold(31, 5); saveSafe(c, outputDir + "/cat_adaptive_threshold.png");
+
+            d = dog; c = cat;
+            d.ditherOrdered(8); saveSafe(d, outputDir + "/dog_dither_bayer.png");
+            c.ditherFloydSteinberg(); saveSafe(c, outputDir + "/cat_dither_floyd.png");
+            d = dog;
+            d.ditherAtkinson(); saveSafe(d, outputDir + "/dog_dither_atkinson.png");
         }
 
         // === Color Adjustments ===
@@ -72,8 +139,78 @@ int main() {
             c.tint(redTint, 0.4f); saveSafe(c, outputDir + "/cat_tint.png");
 
             d = dog; c = cat;
-            d.noise(0.3f); saveSafe(d, outputDir + "/dog_noise.png");
-            c.noise(0.3f); saveSafe(c, outputDir + "/cat_noise.png");
+            d.noise(0.3f, 1); saveSafe(d, outputDir + "/dog_noise.png");
+            c.noise(0.3f, 2); saveSafe(c, outputDir + "/cat_noise.png");
+
+            d = dog; c = cat;
+            d.gaussianNoise(20.0f, 1); saveSafe(d, outputDir + "/dog_gaussian_noise.png");
+            c.gaussianNoise(20.0f, 2); saveSafe(c, outputDir + "/cat_gaussian_noise.png");
+
+            d = dog; c = cat;
+            d.saturation(1.6f); saveSafe(d, outputDir + "/dog_saturation.png");
+            c.hueShift(120.0f); saveSafe(c, outputDir + "/cat_hue_shift.png");
+
+            // Lift L* in Lab float planes, then pack back to RGBA
+            PlanarImage<float> lab = dog.toPlanar(ColorSpace::Lab);
+            for (float& lightness : lab.planes[0]) lightness = std::min(100.0f, lightness * 1.2f);
+            d.fromPlanar(lab); saveSafe(d, outputDir + "/dog_lab_lightness.png");
+        }
+
+        // === HDR tone mapping ===
+        {
+            // Synthesise a radiance map from the dog (linearised, exposure rising 64x left to right),
+            // round-trip it through a Radiance .hdr file and tone map it back to 8 bits
+            PlanarImage<float> linear = convertPlanes<float>(dog.unpackPlanes());
+            std::vector<float> radiance(static_cast<size_t>(linear.width) * linear.height * 3);
+            for (int y = 0; y < linear.height; ++y) {
+                for (int x = 0; x < linear.width; ++x) {
+                    float gain = std::exp2(6.0f * x / linear.width);
+                    for (int c = 0; c < 3; ++c) {
+                        radiance[(static_cast<size_t>(y) * linear.width + x) * 3 + c] = std::pow(linear.row(c, y)[x], 2.2f) * gain;
+                    }
+                }
+            }
+            const std::string hdrPath = outputDir + "/dog_radiance.hdr";
+            stbi_write_hdr(hdrPath.c_str(), linear.width, linear.height, 3, radiance.data());
+
+            PlanarImage<float> hdr = loadPlanarImage<float>(hdrPath.c_str());
+            std::cout << "Log-average luminance (dog HDR): " << logAverageLuminance(hdr) << "\n";
+            ImageData mapped = toneMap(hdr, ToneMapOperator::Reinhard); saveSafe(mapped, outputDir + "/dog_tonemap_reinhard.png");
+            mapped = toneMap(hdr, ToneMapOperator::ACES); saveSafe(mapped, outputDir + "/dog_tonemap_aces.png");
+            mapped = toneMap(hdr, ToneMapOperator::Filmic); saveSafe(mapped, outputDir + "/dog_tonemap_filmic.png");
+        }
+
+        // === Palette quantization ===
+        {
+            ImageData d = dog, c = cat;
+            d.quantize(16, QuantizeMethod::MedianCut);
+            d.saveImage((outputDir + "/dog_quantize16.png").c_str(), ImageFormat::IndexedPNG);
+            c.quantize(32, QuantizeMethod::KMeans);
+            c.saveImage((outputDir + "/cat_quantize32.png").c_str(), ImageFormat::IndexedPNG);
+        }
+
+        // === PNG compression settings ===
+        {
+            for (int level : { 1, 6, 9 }) {
+                std::cout << "PNG level " << level << ": " << cat.encodeTo(ImageFormat::PNG, 90, { level }).size() << " bytes\n";
+            }
+            dog.saveImage((outputDir + "/dog_paeth_level9.png").c_str(), ImageFormat::PNG, 90, { 9, PngFilter::Paeth });
+
+            // Streamed from a row producer: only one band of the panorama is ever in memory
+            const int panoramaWidth = 4096, panoramaHeight = 512;
+            std::ofstream panorama(outputDir + "/gradient_panorama.png", std::ios::binary);
+            encodePngStream(panoramaWidth, panoramaHeight, 3, [&](int firstRow, int rowCount, unsigned char* band) {
+                for (int y = firstRow; y < firstRow + rowCount; ++y) {
+                    for (int x = 0; x < panoramaWidth; ++x) {
+                        *band++ = static_cast<unsigned char>(x * 255 / panoramaWidth);
+                        *band++ = static_cast<unsigned char>(y * 255 / panoramaHeight);
+                        *band++ = static_cast<unsigned char>(128 + 127 * std::sin(x * 0.01));
+                    }
+                }
+            }, [&](const unsigned char* data, size_t size) {
+                panorama.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+            }, { 1 });
+            std::cout << "✅ Saved: " << outputDir << "/gradient_panorama.png\n";
         }
 
         // === Geometry ===
@@ -89,6 +226,22 @@ int main() {
             d = dog; c = cat;
             d.resize(d.getWidth() / 2, d.getHeight() / 2); saveSafe(d, outputDir + "/dog_resize.png");
             c.crop(50, 50, c.getWidth() / 2, c.getHeight() / 2); saveSafe(c, outputDir + "/cat_crop.png");
+
+            // Deskew-style rotation about the centre, and a keystone perspective
+            d = dog; c = cat;
+            const float angle = 0.26f;
+            const float cx = d.getWidth() / 2.0f, cy = d.getHeight() / 2.0f;
+            const float cs = std::cos(angle), sn = std::sin(angle);
+            d.warpAffine({ cs, -sn, cx - cs * cx + sn * cy, sn, cs, cy - sn * cx - cs * cy }, Interpolation::Bilinear);
+            saveSafe(d, outputDir + "/dog_warpAffine.png");
+            c.warpPerspective({ 1.0f, 0.2f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0008f, 1.0f }, Interpolation::Bicubic);
+            saveSafe(c, outputDir + "/cat_warpPerspective.png");
+
+            ImagePyramid pyramid = dog.buildPyramid(4, PyramidFilter::Gaussian);
+            for (int i = 1; i < pyramid.levelCount(); ++i) {
+                ImageData level = pyramid.level(i);
+                saveSafe(level, outputDir + "/dog_pyramid" + std::to_string(i) + ".png");
+            }
         }
 
         // === Compositing (dog + cat) ===
@@ -107,6 +260,64 @@ int main() {
             d = dog; d.average(c); saveSafe(d, outputDir + "/average_dog_cat.png");
             d = dog; d.max(c); saveSafe(d, outputDir + "/max_dog_cat.png");
             d = dog; d.min(c); saveSafe(d, outputDir + "/min_dog_cat.png");
+
+            // Half-transparent cat composited over the dog, straight and premultiplied
+            c.applyAlphaMask(ImageData(c.getWidth(), c.getHeight(), {128, 128, 128, 255}));
+            ImageData over = c; over.compositeOver(dog); saveSafe(over, outputDir + "/over_cat_dog.png");
+            PremultipliedImage premultipliedOver(dog);
+            premultipliedOver.drawOver(PremultipliedImage(c));
+            over = premultipliedOver.toStraight(); saveSafe(over, outputDir + "/over_premultiplied_cat_dog.png");
+
+            // Small round sticker with a soft edge placed over the full-size photo; only its rectangle is touched
+            ImageData sticker = cat;
+            sticker.resize(cat.getWidth() / 5, cat.getHeight() / 5);
+            const float radius = sticker.getWidth() / 2.0f;
+            for (int y = 0; y < sticker.getHeight(); ++y) {
+                for (int x = 0; x < sticker.getWidth(); ++x) {
+                    float distance = std::hypot(x + 0.5f - radius, y + 0.5f - radius);
+                    sticker.getPixel(y, x).a = static_cast<unsigned char>(std::clamp((radius - distance) * 64.0f, 0.0f, 255.0f));
+                }
+            }
+            over = dog;
+            over.drawOver(sticker, over.getWidth() - sticker.getWidth() - 16, 16);
+            saveSafe(over, outputDir + "/sticker_over_dog.png");
+
+            // Small overlays placed by offset touch only the overlapping rectangle
+            ImageData badge = cat;
+            badge.resize(cat.getWidth() / 4, cat.getHeight() / 4);
+            d = dog;
+            d.screen(badge, d.getWidth() - badge.getWidth() - 10, 10);
+            d.multiply(badge, -badge.getWidth() / 2, d.getHeight() - badge.getHeight() / 2);
+            saveSafe(d, outputDir + "/badges_dog_cat.png");
+
+            // Custom blend op (exclusion) on the shared compositing driver
+            d = dog;
+            d.compositeWith(c, [](unsigned char a, unsigned char b) {
+                return static_cast<unsigned char>(a + b - 2 * a * b / 255);
+            });
+            saveSafe(d, outputDir + "/exclusion_dog_cat.png");
+        }
+
+        // === Layer stack (collage) ===
+        {
+            ImageData canvas = dog;
+            ImageData thumb = cat;
+            thumb.resize(cat.getWidth() / 3, cat.getHeight() / 3);
+            ImageData fade(thumb.getWidth(), thumb.getHeight());
+            for (int y = 0; y < fade.getHeight(); ++y) {
+                for (int x = 0; x < fade.getWidth(); ++x) {
+                    unsigned char v = static_cast<unsigned char>(255 * x / fade.getWidth());
+                    fade.setPixel(y, x, { v, v, v, 255 });
+                }
+            }
+
+            LayerStack stack;
+            stack.addLayer({ &thumb, BlendMode::Normal, 1.0f, nullptr, 16, 16 });
+            stack.addLayer({ &thumb, BlendMode::Screen, 0.8f, &fade, canvas.getWidth() - thumb.getWidth() - 16, 16 });
+            stack.addLayer({ &thumb, BlendMode::Multiply, 1.0f, nullptr, -thumb.getWidth() / 2, canvas.getHeight() - thumb.getHeight() });
+            stack.addLayer({ &cat, BlendMode::Overlay, 0.35f, nullptr, 0, 0 });
+            stack.render(canvas);
+            saveSafe(canvas, outputDir + "/layers_dog_cat.png");
         }
 
         // === Convolution / Kernels ===
@@ -130,6 +341,28 @@ int main() {
                 saveSafe(copy, outputDir + "/dog_" + name + ".png");
             }
 
+            ImageData blurred = dog;
+            blurred.boxBlur(8); saveSafe(blurred, outputDir + "/dog_boxblur_r8.png");
+
+            // Planar path: blur only the colour planes, screen against the cat, then repack
+            PlanarImage<unsigned char> planes = dog.unpackPlanes();
+            convolvePlanes(planes, { {1 / 16.0f, 2 / 16.0f, 1 / 16.0f}, {2 / 16.0f, 4 / 16.0f, 2 / 16.0f}, {1 / 16.0f, 2 / 16.0f, 1 / 16.0f} });
+            if (cat.getWidth() == dog.getWidth() && cat.getHeight() == dog.getHeight()) {
+                compositePlanes(planes, cat.unpackPlanes(), BlendOps::Screen{});
+            }
+            blurred.packPlanes(planes); saveSafe(blurred, outputDir + "/dog_planar_gaussian_screen.png");
+
+            // Float planes: contrast up then back down loses nothing, unlike two 8-bit passes
+            PlanarImage<float> wide = convertPlanes<float>(dog.unpackPlanes());
+            contrastPlanes(wide, 2.0f);
+            convolvePlanes(wide, { {0, -1, 0}, {-1, 5, -1}, {0, -1, 0} });
+            contrastPlanes(wide, 0.5f);
+            blurred.packPlanes(convertPlanes<unsigned char>(wide)); saveSafe(blurred, outputDir + "/dog_float_chain.png");
+
+            PlanarImage<std::uint16_t> deep = loadPlanarImage<std::uint16_t>(inputCat.c_str());
+            convolvePlanes(deep, { {1 / 9.0f, 1 / 9.0f, 1 / 9.0f}, {1 / 9.0f, 1 / 9.0f, 1 / 9.0f}, {1 / 9.0f, 1 / 9.0f, 1 / 9.0f} });
+            savePlanarImage(deep, (outputDir + "/cat_boxblur_16bit.png").c_str());
+
             for (auto [type, name] : kernels) {
                 ImageData copy = cat;
                 copy.applyKernel(getKernel(type));